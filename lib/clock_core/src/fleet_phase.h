@@ -0,0 +1,52 @@
+// Beacon filtering and phase alignment of LAN phase sync. Kept free of Arduino headers so a
+// simulated follower can run in the native tests (pio test -e native -f test_fleet).
+#pragma once
+
+#include <stdint.h>
+
+// Part of a slew of slewMs spread at ratePpm that has been applied elapsedMs after it started.
+inline int32_t slewProgressMs(int32_t slewMs, uint64_t elapsedMs, uint32_t ratePpm) {
+  const uint64_t budget = (elapsedMs * ratePpm) / 1000000ULL;
+  const uint32_t magnitude = slewMs < 0 ? -static_cast<uint32_t>(slewMs) : static_cast<uint32_t>(slewMs);
+  const int32_t applied = static_cast<int32_t>(magnitude < budget ? magnitude : budget);
+  return slewMs < 0 ? -applied : applied;
+}
+
+// One-way offsets include the network and loop delays, which are always positive, so the
+// largest offset of a window comes from the least delayed beacon and is the one applied.
+struct FleetWindow {
+  uint8_t count{0};
+  int64_t bestOffsetMs{INT64_MIN};
+
+  void reset() {
+    count = 0;
+    bestOffsetMs = INT64_MIN;
+  }
+
+  // True once size beacons were added, with the correction of the window in correctionMs;
+  // the next beacon then starts a new window.
+  bool add(int64_t offsetMs, uint8_t size, int64_t &correctionMs) {
+    if (offsetMs > bestOffsetMs) {
+      bestOffsetMs = offsetMs;
+    }
+    if (++count < size) {
+      return false;
+    }
+    correctionMs = bestOffsetMs;
+    reset();
+    return true;
+  }
+};
+
+struct PhaseAlignment {
+  bool step;
+  uint64_t anchorEpochMs;  // new anchor, taken at the local time epochMs was read
+  int32_t slewMs;
+};
+
+// Moves a time base that reads epochMs now by errorMs: slewed when small, stepped otherwise.
+inline PhaseAlignment planPhaseAlignment(uint64_t epochMs, int64_t errorMs, int32_t stepThresholdMs) {
+  const bool step = errorMs >= stepThresholdMs || errorMs <= -stepThresholdMs;
+  return {step, static_cast<uint64_t>(static_cast<int64_t>(epochMs) + (step ? errorMs : 0)),
+          step ? 0 : static_cast<int32_t>(errorMs)};
+}
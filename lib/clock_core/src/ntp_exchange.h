@@ -0,0 +1,111 @@
+// SNTP packet handling and the non-blocking request/reply exchange used by the NTP client.
+// Kept free of Arduino headers so it runs against a loopback responder in the native tests
+// (pio test -e native -f test_ntp).
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+constexpr size_t NTP_PACKET_BYTES = 48;
+constexpr uint32_t NTP_UNIX_EPOCH_OFFSET = 2208988800UL;  // 1900-01-01 -> 1970-01-01
+
+inline uint32_t readBe32(const uint8_t *bytes) {
+  return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+         (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+inline void writeBe32(uint8_t *bytes, uint32_t value) {
+  bytes[0] = value >> 24;
+  bytes[1] = value >> 16;
+  bytes[2] = value >> 8;
+  bytes[3] = value;
+}
+
+inline int64_t ntpTimestampToEpochMs(const uint8_t *bytes) {
+  const uint32_t seconds = readBe32(bytes) - NTP_UNIX_EPOCH_OFFSET;
+  const uint32_t fractionMs = static_cast<uint32_t>((static_cast<uint64_t>(readBe32(bytes + 4)) * 1000) >> 32);
+  return static_cast<int64_t>(seconds) * 1000 + fractionMs;
+}
+
+// The server echoes the transmit timestamp as the originate timestamp of its reply: a cookie
+// made of the send time and the round generation ties each reply to this exact request.
+inline void buildNtpRequest(uint8_t *packet, uint32_t sentMs, uint32_t generation) {
+  memset(packet, 0, NTP_PACKET_BYTES);
+  packet[0] = 0b11100011;  // LI = unsynchronised, version 4, mode 3 (client)
+  writeBe32(packet + 40, sentMs);
+  writeBe32(packet + 44, generation);
+}
+
+inline bool isNtpReplyTo(const uint8_t *packet, uint32_t sentMs, uint32_t generation) {
+  return readBe32(packet + 24) == sentMs && readBe32(packet + 28) == generation;
+}
+
+inline bool isUsableNtpReply(const uint8_t *packet) {
+  const uint8_t leap = packet[0] >> 6;
+  const uint8_t mode = packet[0] & 0x07;
+  const uint8_t stratum = packet[1];
+  // Stratum 0 is a kiss-of-death, leap indicator 3 an unsynchronised server.
+  return mode == 4 && leap != 3 && stratum >= 1 && stratum <= 15 && readBe32(packet + 40) != 0;
+}
+
+struct NtpMeasurement {
+  int64_t offsetMs;  // server time minus the local time base
+  int64_t rttMs;     // negative when the server timestamps are inconsistent
+};
+
+// Standard four-timestamp offset and delay. t1 and t4 are the local send and receive times,
+// read on the same time base as the one being disciplined.
+inline NtpMeasurement measureNtpReply(const uint8_t *packet, int64_t t1, int64_t t4) {
+  const int64_t t2 = ntpTimestampToEpochMs(packet + 32);
+  const int64_t t3 = ntpTimestampToEpochMs(packet + 40);
+  return {((t2 - t1) + (t3 - t4)) / 2, (t4 - t1) - (t3 - t2)};
+}
+
+enum class NtpPoll : uint8_t {
+  Pending,   // nothing usable yet, poll again on the next loop()
+  Reply,     // the reply to the current request is in the buffer
+  Unusable,  // the server answered but cannot be trusted (kiss-of-death, unsynchronised)
+  Timeout,   // no reply in time, another attempt is allowed
+  Failed,    // no reply in time and the attempts are used up
+};
+
+// One request/reply exchange with a server. Nothing here waits: send() hands the datagram to
+// the socket and poll() only looks at what has already arrived, so the caller polls it from
+// loop() and sends again on Timeout.
+//
+// Udp provides:
+//   bool send(const uint8_t *packet, size_t size);  // drops datagrams still pending first
+//   int receive(uint8_t *packet, size_t size);      // next datagram from the server: its size,
+//                                                   // 0 when none is pending, < 0 when it came
+//                                                   // from another address
+struct NtpExchange {
+  uint32_t sentMs{0};
+  uint32_t generation{0};
+  uint8_t attempt{0};  // requests sent for the current sample
+
+  template <typename Udp>
+  bool send(Udp &udp, uint32_t nowMs, uint32_t round) {
+    uint8_t packet[NTP_PACKET_BYTES];
+    sentMs = nowMs;
+    generation = round;
+    buildNtpRequest(packet, sentMs, generation);
+    ++attempt;
+    return udp.send(packet, sizeof(packet));
+  }
+
+  template <typename Udp>
+  NtpPoll poll(Udp &udp, uint32_t nowMs, uint32_t timeoutMs, uint8_t maxAttempts, uint8_t *reply) {
+    const int size = udp.receive(reply, NTP_PACKET_BYTES);
+    if (size >= static_cast<int>(NTP_PACKET_BYTES)) {
+      if (!isNtpReplyTo(reply, sentMs, generation)) {
+        return NtpPoll::Pending;  // late reply to an older request, keep waiting for ours
+      }
+      return isUsableNtpReply(reply) ? NtpPoll::Reply : NtpPoll::Unusable;
+    }
+    if (size == 0 && nowMs - sentMs >= timeoutMs) {
+      return attempt < maxAttempts ? NtpPoll::Timeout : NtpPoll::Failed;
+    }
+    return NtpPoll::Pending;
+  }
+};
@@ -0,0 +1,49 @@
+// WS2812 bitstream encoding for the I2S DMA LED backend. Kept free of Arduino headers so the
+// frame layout can be checked by the native tests (pio test -e native).
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// WS2812 bits are stretched to 4 I2S bits at 3.2 MHz: 0 -> 1000, 1 -> 1110. One colour byte
+// therefore becomes exactly one 32-bit I2S sample, sent MSB first.
+constexpr uint32_t WS2812_I2S_SAMPLE_RATE = 100000;  // 32 bits per sample -> 3.2 MHz bit clock
+constexpr uint16_t WS2812_RESET_SAMPLES = 32;        // 320 us low, enough to latch WS2812B
+
+// The core I2S DMA only sends whole 64-word buffers and keeps at most 7 of them queued.
+constexpr size_t I2S_DMA_BUFFER_SAMPLES = 64;
+constexpr size_t I2S_DMA_QUEUE_SAMPLES = 7 * I2S_DMA_BUFFER_SAMPLES;
+
+constexpr uint32_t encodeWs2812Byte(uint8_t value) {
+  uint32_t sample = 0;
+  for (uint8_t bit = 0; bit < 8; ++bit) {
+    sample = (sample << 4) | ((value & (0x80 >> bit)) ? 0b1110 : 0b1000);
+  }
+  return sample;
+}
+
+static_assert(encodeWs2812Byte(0x00) == 0x88888888UL, "WS2812 zero bits must be 1000");
+static_assert(encodeWs2812Byte(0xFF) == 0xEEEEEEEEUL, "WS2812 one bits must be 1110");
+
+// Frame bytes plus the reset gap, padded with low samples to a DMA buffer boundary.
+constexpr size_t i2sFrameSamples(size_t bytes) {
+  return (bytes + WS2812_RESET_SAMPLES + I2S_DMA_BUFFER_SAMPLES - 1) / I2S_DMA_BUFFER_SAMPLES *
+         I2S_DMA_BUFFER_SAMPLES;
+}
+
+// Clears the samples following length encoded bytes up to i2sFrameSamples(length), which is
+// returned: the strip latches during these low samples.
+inline size_t padWs2812Frame(uint32_t *samples, size_t length) {
+  const size_t total = i2sFrameSamples(length);
+  memset(samples + length, 0, (total - length) * sizeof(samples[0]));
+  return total;
+}
+
+// Encodes a GRB frame into samples, which must hold i2sFrameSamples(length) words.
+inline size_t encodeWs2812Frame(const uint8_t *grb, size_t length, uint32_t *samples) {
+  for (size_t i = 0; i < length; ++i) {
+    samples[i] = encodeWs2812Byte(grb[i]);
+  }
+  return padWs2812Frame(samples, length);
+}
@@ -6,31 +6,121 @@
 #include <ESP8266WiFi.h>
 #include <LittleFS.h>
 #include <WiFiManager.h>
+#include <WiFiUdp.h>
 #include <ArduinoOTA.h>
 #include <time.h>
+#include <type_traits>
+#include <utility>
+#include <lwip/dns.h>
+#include <user_interface.h>
+#ifdef UMM_STATS_FULL
+#include <umm_malloc/umm_malloc.h>
+#endif
 #include <SinricPro.h>
 #include <SinricProLight.h>
 #include "index.h"
+#include "fleet_phase.h"
+#include "ntp_exchange.h"
+#include "ws2812_i2s.h"
 
 // uncomment the line below to enable logging into serial
 #define DEBUG_SERIAL
 
+// LED output backend, override with -DLED_OUTPUT_BACKEND=<n> in platformio.ini build_flags.
+#define LED_OUTPUT_NEOPIXEL 0   // Adafruit_NeoPixel bit-bang on LED_PIN (interrupts off during show)
+#define LED_OUTPUT_I2S_DMA 1    // WS2812 bitstream sent by I2S DMA on GPIO3 (RX pin)
+#define LED_OUTPUT_RECORDING 2  // no LED output, encoded frames are kept in RAM for /api/output
+#ifndef LED_OUTPUT_BACKEND
+#define LED_OUTPUT_BACKEND LED_OUTPUT_NEOPIXEL
+#endif
+
+#if LED_OUTPUT_BACKEND == LED_OUTPUT_I2S_DMA
+#include <i2s.h>
+#endif
+
+// Compiled-in display layout, override with -DCLOCK_LAYOUT=<n>. /layout.json takes precedence.
+#define CLOCK_LAYOUT_HHMM_1 0    // 4 digits, 1 LED per segment, 30 LEDs
+#define CLOCK_LAYOUT_HHMMSS_3 1  // 6 digits, 3 LEDs per segment, 130 LEDs
+#define CLOCK_LAYOUT_HHMMSS_5 2  // 6 digits, 5 LEDs per segment, 214 LEDs
+#ifndef CLOCK_LAYOUT
+#define CLOCK_LAYOUT CLOCK_LAYOUT_HHMM_1
+#endif
+
 namespace {
 constexpr uint8_t LED_PIN = 12;
-constexpr uint16_t LED_COUNT = 30;
-constexpr uint8_t DIGIT_COUNT = 4;
+constexpr uint8_t MAX_DIGIT_COUNT = 6;
+constexpr uint8_t MAX_DOT_COUNT = 4;
+constexpr uint8_t DIGIT_COUNT = 4;  // digits with a configurable colour (HH:MM)
 constexpr uint8_t SEGMENTS_PER_DIGIT = 7;
-constexpr uint8_t DOT_LEFT_INDEX = 14;
-constexpr uint8_t DOT_RIGHT_INDEX = 15;
 constexpr uint8_t HOUR_TENS_DIGIT_INDEX = 0;
 constexpr char CONFIG_PATH[] = "/config.json";
-constexpr uint32_t DISPLAY_REFRESH_MS = 250;
+constexpr char CONFIG_SLOT_PATHS[2][12] = {"/config.0", "/config.1"};
+constexpr uint32_t CONFIG_RECORD_MAGIC = 0x47464343UL;  // "CCFG"
+constexpr uint16_t CONFIG_RECORD_VERSION = 1;            // bump whenever ConfigSnapshot changes
+constexpr size_t CONFIG_MODE_BYTES = 12;
+constexpr size_t CONFIG_HOSTNAME_BYTES = 64;
+constexpr size_t CONFIG_TIMEZONE_BYTES = 64;
+constexpr size_t CONFIG_ADDRESS_BYTES = 16;
+constexpr size_t CONFIG_SINRIC_KEY_BYTES = 64;
+constexpr size_t CONFIG_SINRIC_SECRET_BYTES = 128;
+constexpr size_t CONFIG_SINRIC_DEVICE_BYTES = 32;
+constexpr uint32_t CONFIG_SAVE_QUIET_MS = 3000;       // config is written once changes stop for this long
+constexpr uint32_t CONFIG_SAVE_MAX_DELAY_MS = 30000;  // ...or at the latest this long after the first change
+constexpr char LAYOUT_PATH[] = "/layout.json";
+constexpr char ANIMATION_PATH[] = "/animation.bin";
+constexpr char ANIMATION_UPLOAD_PATH[] = "/animation.tmp";
+constexpr uint32_t DISPLAY_MAX_IDLE_MS = 60000;  // upper bound between two renders when nothing is due
+constexpr uint32_t DISPLAY_LATENCY_TARGET_MS = 5;  // visible delay allowed after a clock digit changes
+constexpr uint32_t DISPLAY_RETRY_MS = 1;           // retry delay when the LED output was still busy
 constexpr size_t JSON_CAPACITY = 3072;
-constexpr uint8_t NTP_MAX_ATTEMPTS = 40;
-constexpr uint16_t NTP_RETRY_DELAY_MS = 250;
+constexpr uint8_t MAX_NTP_SERVERS = 4;
+constexpr uint8_t NTP_SAMPLES_PER_SERVER = 2;
+constexpr uint8_t NTP_MAX_ATTEMPTS = 2;  // requests sent per sample before moving to the next server
+constexpr uint32_t NTP_MAX_RTT_MS = 1000;      // slower replies are not trusted
+constexpr uint32_t NTP_OUTLIER_MS = 250;       // max distance from the median offset
+constexpr uint32_t NTP_DNS_CACHE_TTL_MS = 6UL * 60UL * 60UL * 1000UL;
+constexpr uint32_t NTP_DNS_TIMEOUT_MS = 5000;
+constexpr uint32_t NTP_REPLY_TIMEOUT_MS = 1500;
+constexpr uint16_t NTP_PORT = 123;
+constexpr uint16_t NTP_LOCAL_PORT = 4123;
+constexpr int32_t TIME_STEP_THRESHOLD_MS = 1000;         // larger sync errors step, smaller ones slew
+constexpr uint32_t TIME_SLEW_RATE_PPM = 5000;            // 5 ms per second while slewing
+constexpr uint32_t DRIFT_MIN_INTERVAL_MS = 10UL * 60UL * 1000UL;
+constexpr int32_t DRIFT_MAX_PPB = 500000;                // +/-500 ppm
 constexpr uint32_t NTP_SYNC_INTERVAL_MS = 24UL * 60UL * 60UL * 1000UL;
 constexpr uint32_t NTP_RETRY_INTERVAL_MS = 10UL * 60UL * 1000UL;
+constexpr uint16_t FLEET_DEFAULT_PORT = 4242;
+constexpr uint32_t FLEET_BEACON_INTERVAL_MS = 500;
+constexpr uint8_t FLEET_WINDOW_BEACONS = 8;            // beacons filtered into one phase correction
+constexpr uint32_t FLEET_LOCK_TIMEOUT_MS = 5000;       // a silent leader is dropped after this
+constexpr size_t FLEET_PACKET_BYTES = 20;
+constexpr uint32_t RTC_CHECKPOINT_OFFSET = 32;  // RTC user memory block; the first 128 bytes belong to OTA
+constexpr uint32_t RTC_CHECKPOINT_MAGIC = 0x434C4B31UL;  // "CLK1"
+constexpr uint32_t RTC_CHECKPOINT_INTERVAL_MS = 10000;  // bounds the span timed by the RTC after a crash
+constexpr uint32_t RTC_RESTORE_MAX_AGE_MS = 60UL * 60UL * 1000UL;  // older checkpoints are not trusted
 constexpr uint32_t DEFAULT_ALARM_DURATION_MS = 5UL * 60UL * 1000UL;
+constexpr uint8_t MAX_ALARMS = 20;
+constexpr uint8_t DEFAULT_SNOOZE_MINUTES = 9;
+constexpr uint8_t MAX_SUNRISE_MINUTES = 60;
+constexpr uint8_t ALARM_SOURCE_TIMER = 0xFF;       // AlarmState::ringing while a countdown expired
+constexpr uint32_t ALARM_FADE_IN_MS = 1000;          // overlay opacity ramp when an alarm starts ringing
+constexpr uint32_t TIMER_EXPIRY_MS = 60000;          // alarm overlay shown when a countdown ends
+constexpr uint32_t DEFAULT_TIMER_DURATION_MS = 5UL * 60UL * 1000UL;
+constexpr uint32_t MAX_TIMER_DURATION_MS = 100UL * 60UL * 60UL * 1000UL - 1000UL;  // 99:59:59
+constexpr uint8_t MAX_TIMER_LAPS = 10;
+constexpr uint8_t MAX_SCHEDULE_POINTS = 12;
+constexpr uint16_t MINUTES_PER_DAY = 1440;
+constexpr uint16_t COLOR_TEMPERATURE_MIN_K = 2000;
+constexpr uint16_t COLOR_TEMPERATURE_NEUTRAL_K = 6500;  // no tint
+constexpr uint32_t FRAME_BUDGET_US = 4000;
+constexpr uint32_t EFFECT_FRAME_MS = 20;      // 50 fps while an animated effect runs
+constexpr uint32_t TRANSITION_FRAME_MS = 16;  // ~60 fps while digits crossfade
+constexpr uint32_t DEFAULT_TRANSITION_MS = 300;
+constexpr uint32_t DITHER_FRAME_MS = 4;    // temporal dithering refresh (4 phases -> 16 ms cycle)
+constexpr uint16_t DITHER_MAX_LEVEL = 32;  // dither only channels dimmer than this output level
+constexpr uint32_t HTTP_LATENCY_TARGET_US = 20000;  // max gap between two handleClient() calls
+constexpr uint8_t ANIMATION_MAX_FPS = 60;
+constexpr size_t ANIMATION_BUFFER_BYTES = 120;  // streaming window: 40 keyframe LEDs or 24 deltas
 
 
 // Segment encoding order: A, B, C, D, E, F, G (bit 0 = segment A)
@@ -46,18 +136,199 @@ constexpr uint8_t DIGIT_SEGMENTS[10] = {
     0b01111111, // 8
     0b01101111  // 9
 };
+constexpr uint8_t BLANK_GLYPH = 10;
+
+// Seven-segment font for printable ASCII (0x20-0x7F), same bit order as DIGIT_SEGMENTS.
+// Letters without a readable shape fall back to their closest approximation.
+constexpr uint8_t FONT_FIRST_CHAR = 0x20;
+constexpr uint8_t FONT_DEGREE = 0x7F;  // DEL slot is reused for the degree sign
+constexpr uint8_t FONT_SEGMENTS[96] = {
+    // space ! " # $ % & ' ( ) * + , - . /
+    0x00, 0x06, 0x22, 0x00, 0x6D, 0x00, 0x00, 0x20, 0x39, 0x0F, 0x63, 0x46, 0x10, 0x40, 0x00, 0x52,
+    // 0 1 2 3 4 5 6 7 8 9 : ; < = > ?
+    0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F, 0x00, 0x00, 0x58, 0x48, 0x4C, 0x53,
+    // @ A B C D E F G H I J K L M N O
+    0x5F, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, 0x76, 0x30, 0x1E, 0x75, 0x38, 0x37, 0x54, 0x3F,
+    // P Q R S T U V W X Y Z [ \ ] ^ _
+    0x73, 0x67, 0x50, 0x6D, 0x78, 0x3E, 0x1C, 0x7E, 0x76, 0x6E, 0x5B, 0x39, 0x64, 0x0F, 0x23, 0x08,
+    // ` a b c d e f g h i j k l m n o
+    0x02, 0x77, 0x7C, 0x58, 0x5E, 0x79, 0x71, 0x6F, 0x74, 0x10, 0x0E, 0x75, 0x30, 0x37, 0x54, 0x5C,
+    // p q r s t u v w x y z { | } ~ degree
+    0x73, 0x67, 0x50, 0x6D, 0x78, 0x1C, 0x1C, 0x7E, 0x76, 0x6E, 0x5B, 0x39, 0x30, 0x0F, 0x01, 0x63};
+
+constexpr uint8_t fontSegments(char value) {
+  return (static_cast<uint8_t>(value) >= FONT_FIRST_CHAR && static_cast<uint8_t>(value) <= FONT_DEGREE)
+             ? FONT_SEGMENTS[static_cast<uint8_t>(value) - FONT_FIRST_CHAR]
+             : 0;
+}
+
+constexpr bool fontMatchesDigits() {
+  for (uint8_t digit = 0; digit < 10; ++digit) {
+    if (fontSegments(static_cast<char>('0' + digit)) != DIGIT_SEGMENTS[digit]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(fontMatchesDigits(), "font digits must match DIGIT_SEGMENTS");
+static_assert(fontSegments('-') == 0x40 && fontSegments('C') == 0x39, "minus and C glyphs");
+
+// One sine period over 256 steps, offset to 0..255 (128 = zero crossing).
+static const uint8_t SINE_TABLE[256] PROGMEM = {
+    128, 131, 134, 137, 140, 144, 147, 150, 153, 156, 159, 162, 165, 168, 171, 174,
+    177, 179, 182, 185, 188, 191, 193, 196, 199, 201, 204, 206, 209, 211, 213, 216,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 239, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 239, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 216, 213, 211, 209, 206, 204, 201, 199, 196, 193, 191, 188, 185, 182, 179,
+    177, 174, 171, 168, 165, 162, 159, 156, 153, 150, 147, 144, 140, 137, 134, 131,
+    128, 125, 122, 119, 116, 112, 109, 106, 103, 100,  97,  94,  91,  88,  85,  82,
+     79,  77,  74,  71,  68,  65,  63,  60,  57,  55,  52,  50,  47,  45,  43,  40,
+     38,  36,  34,  32,  30,  28,  26,  24,  22,  21,  19,  17,  16,  15,  13,  12,
+     11,  10,   8,   7,   6,   6,   5,   4,   3,   3,   2,   2,   2,   1,   1,   1,
+      1,   1,   1,   1,   2,   2,   2,   3,   3,   4,   5,   6,   6,   7,   8,  10,
+     11,  12,  13,  15,  16,  17,  19,  21,  22,  24,  26,  28,  30,  32,  34,  36,
+     38,  40,  43,  45,  47,  50,  52,  55,  57,  60,  63,  65,  68,  71,  74,  77,
+     79,  82,  85,  88,  91,  94,  97, 100, 103, 106, 109, 112, 116, 119, 122, 125
+};
 
-// Custom LED order on the strip (digit wiring: 1=e, 2=d, 3=c, 4=g, 5=f, 6=a, 7=b).
-constexpr uint8_t SEGMENT_LED_OFFSET[SEGMENTS_PER_DIGIT] = {
-    5, // segment A uses LED 6
-    6, // segment B uses LED 7
-    2, // segment C uses LED 3
-    1, // segment D uses LED 2
-    0, // segment E uses LED 1
-    4, // segment F uses LED 5
-    3  // segment G uses LED 4
+// Gamma 2.2 curve in 8.8 fixed point: input 0..255 -> linear output 0..255.0 (65280).
+static const uint16_t GAMMA_TABLE[256] PROGMEM = {
+        0,     0,     2,     4,     7,    11,    17,    24,    32,    42,    53,    65,
+       78,    94,   110,   128,   148,   169,   191,   216,   241,   269,   298,   328,
+      360,   394,   430,   467,   506,   547,   589,   633,   679,   726,   776,   827,
+      880,   934,   991,  1049,  1109,  1171,  1235,  1300,  1368,  1437,  1508,  1581,
+     1656,  1733,  1812,  1893,  1975,  2060,  2146,  2235,  2325,  2417,  2512,  2608,
+     2706,  2806,  2908,  3013,  3119,  3227,  3337,  3450,  3564,  3680,  3798,  3919,
+     4041,  4166,  4292,  4421,  4552,  4685,  4819,  4956,  5096,  5237,  5380,  5525,
+     5673,  5823,  5974,  6128,  6284,  6442,  6603,  6765,  6930,  7097,  7266,  7437,
+     7610,  7786,  7963,  8143,  8325,  8509,  8696,  8885,  9075,  9268,  9464,  9661,
+     9861, 10063, 10267, 10474, 10682, 10893, 11107, 11322, 11540, 11760, 11982, 12207,
+    12433, 12663, 12894, 13128, 13363, 13602, 13842, 14085, 14330, 14578, 14827, 15080,
+    15334, 15591, 15850, 16111, 16375, 16641, 16909, 17180, 17453, 17729, 18006, 18287,
+    18569, 18854, 19141, 19431, 19723, 20017, 20314, 20613, 20915, 21218, 21525, 21833,
+    22144, 22458, 22774, 23092, 23413, 23736, 24062, 24390, 24720, 25053, 25388, 25726,
+    26066, 26408, 26753, 27101, 27451, 27803, 28158, 28515, 28875, 29237, 29602, 29969,
+    30338, 30710, 31085, 31462, 31841, 32223, 32608, 32995, 33384, 33776, 34170, 34567,
+    34967, 35369, 35773, 36180, 36589, 37001, 37416, 37833, 38252, 38674, 39099, 39526,
+    39956, 40388, 40823, 41260, 41700, 42142, 42587, 43034, 43484, 43937, 44392, 44849,
+    45310, 45772, 46238, 46706, 47176, 47649, 48125, 48603, 49084, 49567, 50053, 50542,
+    51033, 51526, 52023, 52522, 53023, 53527, 54034, 54543, 55055, 55570, 56087, 56607,
+    57129, 57654, 58182, 58712, 59245, 59780, 60318, 60859, 61402, 61948, 62497, 63048,
+    63602, 64159, 64718, 65280
 };
 
+// Physical description of the display. The segments of a digit are wired one after the
+// other, each made of ledsPerSegment LEDs, in the order given by segmentSlot.
+struct DisplayLayout {
+  uint8_t digitCount;
+  uint8_t ledsPerSegment;
+  uint8_t segmentSlot[SEGMENTS_PER_DIGIT];  // wiring position of segments A..G inside a digit
+  uint16_t digitBase[MAX_DIGIT_COUNT];      // first strip index of each digit
+  uint8_t dotCount;
+  uint16_t dotIndex[MAX_DOT_COUNT];
+  uint16_t ledCount;
+};
+
+// Custom LED order inside a digit (wiring: 1=e, 2=d, 3=c, 4=g, 5=f, 6=a, 7=b).
+#define CLOCK_SEGMENT_WIRING {5, 6, 2, 1, 0, 4, 3}
+
+// Hours, hours, dots, minutes, minutes[, dots, seconds, seconds].
+constexpr DisplayLayout LAYOUT_HHMM_1 = {4, 1, CLOCK_SEGMENT_WIRING, {0, 7, 16, 23}, 2, {14, 15}, 30};
+constexpr DisplayLayout LAYOUT_HHMMSS_3 = {
+    6, 3, CLOCK_SEGMENT_WIRING, {0, 21, 44, 65, 88, 109}, 4, {42, 43, 86, 87}, 130};
+constexpr DisplayLayout LAYOUT_HHMMSS_5 = {
+    6, 5, CLOCK_SEGMENT_WIRING, {0, 35, 72, 107, 144, 179}, 4, {70, 71, 142, 143}, 214};
+
+#if CLOCK_LAYOUT == CLOCK_LAYOUT_HHMMSS_3
+constexpr DisplayLayout COMPILED_LAYOUT = LAYOUT_HHMMSS_3;
+#elif CLOCK_LAYOUT == CLOCK_LAYOUT_HHMMSS_5
+constexpr DisplayLayout COMPILED_LAYOUT = LAYOUT_HHMMSS_5;
+#else
+constexpr DisplayLayout COMPILED_LAYOUT = LAYOUT_HHMM_1;
+#endif
+
+// Every per-LED buffer (layers, frames, output, recording) is sized for the compiled layout.
+// A /layout.json or animation with more LEDs needs -DMAX_LEDS=<n> in build_flags.
+#ifdef MAX_LEDS
+constexpr uint16_t MAX_LED_COUNT = MAX_LEDS;
+#else
+constexpr uint16_t MAX_LED_COUNT = COMPILED_LAYOUT.ledCount;
+#endif
+constexpr size_t MAX_FRAME_BYTES = static_cast<size_t>(MAX_LED_COUNT) * 3;
+
+// LEDs of one segment, contiguous on the strip.
+struct SegmentRun {
+  uint16_t start;
+  uint8_t length;
+};
+
+struct LayoutRuns {
+  SegmentRun segment[MAX_DIGIT_COUNT][SEGMENTS_PER_DIGIT];
+};
+
+constexpr LayoutRuns compileLayout(const DisplayLayout &layout) {
+  LayoutRuns runs{};
+  for (uint8_t digit = 0; digit < layout.digitCount && digit < MAX_DIGIT_COUNT; ++digit) {
+    for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+      runs.segment[digit][segment] = {
+          static_cast<uint16_t>(layout.digitBase[digit] + layout.segmentSlot[segment] * layout.ledsPerSegment),
+          layout.ledsPerSegment};
+    }
+  }
+  return runs;
+}
+
+// Rejects layouts whose LEDs fall outside the strip or are claimed twice.
+constexpr bool isLayoutValid(const DisplayLayout &layout) {
+  if (layout.digitCount < DIGIT_COUNT || layout.digitCount > MAX_DIGIT_COUNT || layout.ledsPerSegment == 0 ||
+      layout.dotCount > MAX_DOT_COUNT || layout.ledCount == 0 || layout.ledCount > MAX_LED_COUNT) {
+    return false;
+  }
+  uint8_t slotsSeen = 0;
+  for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+    if (layout.segmentSlot[segment] >= SEGMENTS_PER_DIGIT) {
+      return false;
+    }
+    slotsSeen |= 1 << layout.segmentSlot[segment];
+  }
+  if (slotsSeen != 0x7F) {
+    return false;
+  }
+  bool used[MAX_LED_COUNT] = {};
+  for (uint8_t digit = 0; digit < layout.digitCount; ++digit) {
+    const uint32_t end = layout.digitBase[digit] + static_cast<uint32_t>(SEGMENTS_PER_DIGIT) * layout.ledsPerSegment;
+    if (end > layout.ledCount) {
+      return false;
+    }
+    for (uint32_t led = layout.digitBase[digit]; led < end; ++led) {
+      if (used[led]) {
+        return false;
+      }
+      used[led] = true;
+    }
+  }
+  for (uint8_t dot = 0; dot < layout.dotCount; ++dot) {
+    if (layout.dotIndex[dot] >= layout.ledCount || used[layout.dotIndex[dot]]) {
+      return false;
+    }
+    used[layout.dotIndex[dot]] = true;
+  }
+  return true;
+}
+
+// Layouts larger than the LED buffers are checked by the builds that select them.
+static_assert(isLayoutValid(COMPILED_LAYOUT), "compiled layout does not fit its LED strip");
+static_assert(LAYOUT_HHMM_1.ledCount > MAX_LED_COUNT || isLayoutValid(LAYOUT_HHMM_1),
+              "HH:MM layout does not fit its LED strip");
+static_assert(LAYOUT_HHMMSS_3.ledCount > MAX_LED_COUNT || isLayoutValid(LAYOUT_HHMMSS_3),
+              "HH:MM:SS x3 layout does not fit its LED strip");
+static_assert(LAYOUT_HHMMSS_5.ledCount > MAX_LED_COUNT || isLayoutValid(LAYOUT_HHMMSS_5),
+              "HH:MM:SS x5 layout does not fit its LED strip");
+static_assert(compileLayout(LAYOUT_HHMM_1).segment[2][0].start == 21, "segment A of digit 3 is LED 22");
+
 struct Color {
   uint8_t r{0};
   uint8_t g{0};
@@ -67,10 +338,14 @@ struct Color {
   Color(uint8_t red, uint8_t green, uint8_t blue) : r(red), g(green), b(blue) {}
 };
 
+enum class OperatingMode : uint8_t { Clock, Timer, Weather, Custom, Alarm, Off };
+
+// The config holds no heap objects: modes are enums and text lives in fixed buffers, converted
+// only when it crosses the API or persistence edge.
 struct PowerSettings {
   bool powerOn{true};
-  String startupMode{"clock"};
-  String mode{"clock"};
+  OperatingMode startupMode{OperatingMode::Clock};
+  OperatingMode mode{OperatingMode::Clock};
   bool exitSpecialMode{false};
 };
 
@@ -80,11 +355,22 @@ struct TimeSettings {
   uint8_t second{0};
 };
 
+enum class EffectKind : uint8_t { None, Gradient, Rainbow, Breathing, Animation, Count };
+constexpr uint8_t EFFECT_COUNT = static_cast<uint8_t>(EffectKind::Count);
+
 struct DisplaySettings {
   uint8_t brightness{80};
   Color generalColor{255, 85, 0};
   bool perDigitEnabled{false};
   Color perDigitColor[DIGIT_COUNT];
+  uint16_t transitionMs{DEFAULT_TRANSITION_MS};  // digit crossfade, 0 switches instantly
+  bool gammaCorrection{false};
+  bool dithering{false};
+  struct EffectSettings {
+    EffectKind kind{EffectKind::None};
+    uint8_t speed{64};
+    Color secondaryColor{0, 85, 255};
+  } effect;
   struct QuietHoursSettings {
     bool enabled{false};
     uint8_t startHour{23};
@@ -93,6 +379,19 @@ struct DisplaySettings {
     uint8_t endMinute{0};
     uint8_t dimBrightness{0};
   } quietHours;
+  // Brightness and colour temperature control points over the day; replaces quiet hours when
+  // enabled. Compiled into a per-minute table on every change.
+  struct SchedulePoint {
+    uint16_t minute{0};  // minute of the day
+    uint8_t brightness{80};
+    uint16_t kelvin{COLOR_TEMPERATURE_NEUTRAL_K};
+    bool fade{true};  // ramp linearly to the next point, otherwise hold until it
+  };
+  struct BrightnessSchedule {
+    bool enabled{false};
+    SchedulePoint points[MAX_SCHEDULE_POINTS];
+    uint8_t count{0};
+  } schedule;
 };
 
 struct DotsSettings {
@@ -103,28 +402,39 @@ struct DotsSettings {
   Color forcedColor{255, 0, 0};
 };
 
-struct AlarmSettings {
+struct AlarmEntry {
   bool enabled{false};
   uint8_t hour{7};
   uint8_t minute{0};
-  bool active{false};
-  unsigned long startMs{0};
-  uint8_t lastTriggerHour{255};
-  uint8_t lastTriggerMinute{255};
   uint8_t daysMask{0x7F};  // bits 0-6 represent Sunday-Saturday
   uint32_t durationMs{DEFAULT_ALARM_DURATION_MS};
+  Color color{255, 255, 255};
+  uint8_t sunriseMinutes{0};  // brightness ramp before the alarm, 0 disables it
+  uint8_t snoozeMinutes{DEFAULT_SNOOZE_MINUTES};
+};
+
+struct AlarmSettings {
+  AlarmEntry entries[MAX_ALARMS];
+  uint8_t count{1};  // entry 0 is the alarm edited by the web UI
 };
 
+enum class FleetRole : uint8_t { Off, Leader, Follower };
+
 struct NetworkSettings {
-  String ntpServer{"pool.ntp.org"};
-  int16_t utcOffsetMinutes{0};
+  char ntpServers[MAX_NTP_SERVERS][CONFIG_HOSTNAME_BYTES]{"0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org"};
+  uint8_t ntpServerCount{3};
+  int16_t utcOffsetMinutes{0};           // used when timezone is empty
+  char timezone[CONFIG_TIMEZONE_BYTES]{};  // POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+  FleetRole fleetRole{FleetRole::Off};
+  char fleetGroup[CONFIG_ADDRESS_BYTES]{"239.255.42.42"};  // multicast group shared by the clocks of a LAN
+  uint16_t fleetPort{FLEET_DEFAULT_PORT};
 };
 
 struct SinricSettings {
   bool enabled{false};
-  String appKey;
-  String appSecret;
-  String deviceId;
+  char appKey[CONFIG_SINRIC_KEY_BYTES]{};
+  char appSecret[CONFIG_SINRIC_SECRET_BYTES]{};
+  char deviceId[CONFIG_SINRIC_DEVICE_BYTES]{};
 };
 
 struct ClockConfig {
@@ -137,24 +447,336 @@ struct ClockConfig {
   SinricSettings sinric;
 };
 
-enum class OperatingMode { Clock, Timer, Weather, Custom, Alarm, Off };
+// Runtime alarm state. Enabled alarms are kept in an index sorted by next fire time; only its
+// head is checked per frame, and it is rebuilt when the alarms or the clock change.
+struct AlarmState {
+  bool active{false};
+  uint8_t ringing{0};  // alarm shown while active, ALARM_SOURCE_TIMER for an expired countdown
+  unsigned long startMs{0};
+  uint32_t durationMs{0};
+  Color color;
+  bool indexValid{false};
+  uint8_t order[MAX_ALARMS]{};
+  uint8_t orderCount{0};
+  uint64_t fireUtcMs[MAX_ALARMS]{};
+  uint64_t lastFiredUtcMs[MAX_ALARMS]{};
+  bool snoozed[MAX_ALARMS]{};
+  uint32_t rebuilds{0};
+  uint32_t fired{0};
+  uint32_t snoozes{0};
+};
+
+// Countdown and stopwatch. Elapsed time is accumulated in microseconds from a 64-bit micros(),
+// measured from the last start rather than summed per tick, so long runs never drift.
+enum class TimerKind : uint8_t { Countdown, Stopwatch };
+
+struct TimerState {
+  TimerKind kind{TimerKind::Countdown};
+  bool running{false};
+  bool expired{false};
+  uint32_t durationMs{DEFAULT_TIMER_DURATION_MS};
+  uint64_t accumulatedUs{0};  // elapsed before the current run
+  uint64_t startUs{0};
+  uint32_t lapMs[MAX_TIMER_LAPS]{};  // most recent laps, oldest first
+  uint8_t lapCount{0};
+  uint32_t laps{0};
+  uint32_t expiries{0};
+  uint32_t ticks{0};
+  uint32_t lastShownUnits{UINT32_MAX};
+  uint32_t lastTickLatencyUs{0};
+  uint32_t maxTickLatencyUs{0};
+};
+
+// Receives fully scaled GRB frames from the renderer and sends them to the LEDs.
+class LedOutput {
+ public:
+  virtual ~LedOutput() = default;
+  virtual const char *name() const = 0;
+  virtual void begin(uint16_t ledCount) = 0;
+  // False while the previous frame is still being transmitted.
+  virtual bool canShow() = 0;
+  virtual void show(const uint8_t *grb, size_t length) = 0;
+  // Called from loop() so backends can feed pending data.
+  virtual void service() {}
+  // False when show() blocks long enough that refreshing every DITHER_FRAME_MS would hurt.
+  virtual bool supportsDithering() const { return true; }
+};
+
+class NeoPixelLedOutput : public LedOutput {
+ public:
+  NeoPixelLedOutput(uint16_t count, uint8_t pin) : pixels_(count, pin, NEO_GRB + NEO_KHZ800) {}
+  const char *name() const override { return "neopixel"; }
+  void begin(uint16_t ledCount) override {
+    pixels_.updateLength(ledCount);
+    pixels_.begin();
+    pixels_.clear();
+    pixels_.show();
+  }
+  bool canShow() override { return pixels_.canShow(); }
+  void show(const uint8_t *grb, size_t length) override {
+    memcpy(pixels_.getPixels(), grb, length);
+    pixels_.show();
+  }
+  // show() runs with interrupts off for 30 us per LED.
+  bool supportsDithering() const override { return false; }
+
+ private:
+  Adafruit_NeoPixel pixels_;
+};
+
+#if LED_OUTPUT_BACKEND == LED_OUTPUT_I2S_DMA
+// Uses the core I2S driver: show() encodes the whole frame once and queues it into the DMA
+// ring, which clocks it out in hardware, so show() returns at once. Frames longer than the
+// ring (I2S_DMA_QUEUE_SAMPLES, 149 LEDs) have their tail queued by service() as buffers drain.
+class I2sDmaLedOutput : public LedOutput {
+ public:
+  const char *name() const override { return "i2s-dma"; }
+  void begin(uint16_t ledCount) override {
+    i2s_rxtx_begin(false, true);
+    i2s_set_rate(WS2812_I2S_SAMPLE_RATE);
+    // Blank the strip, as the NeoPixel backend does.
+    const size_t length = min(static_cast<size_t>(ledCount) * 3, MAX_FRAME_BYTES);
+    for (size_t i = 0; i < length; ++i) {
+      samples_[i] = encodeWs2812Byte(0);
+    }
+    queueFrame(padWs2812Frame(samples_, length));
+  }
+  bool canShow() override { return queued_ == total_ && i2s_is_empty(); }
+  void show(const uint8_t *grb, size_t length) override {
+    queueFrame(encodeWs2812Frame(grb, min(length, MAX_FRAME_BYTES), samples_));
+  }
+  void service() override {
+    while (queued_ < total_ && i2s_write_sample_nb(samples_[queued_])) {
+      ++queued_;
+    }
+  }
+
+ private:
+  void queueFrame(size_t total) {
+    total_ = total;
+    queued_ = 0;
+    service();
+  }
+
+  uint32_t samples_[i2sFrameSamples(MAX_FRAME_BYTES)];
+  size_t total_{0};
+  size_t queued_{0};
+};
+#endif
+
+// Keeps the last frames so their WS2812 bitstream (I2S encoding) can be checked remotely.
+// Frames are stored as GRB bytes; encodeWs2812Byte() expands each byte to its I2S word.
+class RecordingLedOutput : public LedOutput {
+ public:
+  static constexpr uint8_t SLOTS = 2;
+  const char *name() const override { return "recording"; }
+  void begin(uint16_t) override { recorded_ = 0; }
+  bool canShow() override { return true; }
+  void show(const uint8_t *grb, size_t length) override {
+    Slot &slot = slots_[recorded_ % SLOTS];
+    slot.sequence = recorded_;
+    slot.length = min(length, MAX_FRAME_BYTES);
+    memcpy(slot.grb, grb, slot.length);
+    ++recorded_;
+  }
+  uint32_t recorded() const { return recorded_; }
+  // Index 0 is the most recent frame.
+  bool frame(uint8_t age, uint32_t &sequence, const uint8_t *&grb, size_t &length) const {
+    if (age >= SLOTS || age >= recorded_) {
+      return false;
+    }
+    const Slot &slot = slots_[(recorded_ - 1 - age) % SLOTS];
+    sequence = slot.sequence;
+    grb = slot.grb;
+    length = slot.length;
+    return true;
+  }
+
+ private:
+  struct Slot {
+    uint32_t sequence{0};
+    size_t length{0};
+    uint8_t grb[MAX_FRAME_BYTES];
+  };
+  Slot slots_[SLOTS];
+  uint32_t recorded_{0};
+};
 
 ClockConfig config;
-TimeSettings timeAnchor;
-unsigned long timeReferenceMs = 0;
-unsigned long lastDisplayRefresh = 0;
+AlarmState alarmState;
+TimerState timer;
+
+// UTC time base in epoch milliseconds, disciplined by NTP:
+//   now = anchorEpochMs + elapsed + elapsed * driftPpb / 1e9 + slew applied so far
+// where elapsed is measured on a 64-bit extension of millis() that survives its 49.7-day wrap.
+struct TimeBase {
+  bool synced{false};
+  uint64_t anchorEpochMs{0};
+  uint64_t anchorLocalMs{0};
+  int32_t driftPpb{0};           // positive when the local oscillator runs slow
+  uint8_t driftSamples{0};
+  int32_t slewMs{0};             // correction spread from anchorLocalMs onwards
+  int32_t lastSyncErrorMs{0};    // NTP time minus predicted time at the last sync
+  uint64_t lastSyncLocalMs{0};   // raw sample kept for the next drift estimate
+  uint64_t lastSyncEpochMs{0};
+  bool driftReference{false};    // false when the last sync sample predates a reset
+  uint32_t steps{0};
+  uint32_t slews{0};
+};
+
+TimeBase timeBase;
+uint32_t millisHigh = 0;
+uint32_t millisLast = 0;
+uint32_t microsHigh = 0;
+uint32_t microsLast = 0;
+
+// Next render deadline. Idle faces wake exactly when something visible changes; animations
+// wake at their frame rate.
+struct DisplaySchedule {
+  unsigned long nextRefreshMs{0};
+  bool animated{false};
+  bool throttled{false};
+  bool framePending{false};  // last frame deferred because the output was busy
+};
+
+struct SchedulerStats {
+  uint32_t renders{0};
+  uint32_t eventWakeups{0};
+  uint32_t clockChanges{0};
+  uint32_t lastChangeLatencyMs{0};
+  uint32_t maxChangeLatencyMs{0};
+  uint32_t latencyOverTarget{0};
+};
+
+DisplaySchedule displaySchedule;
+SchedulerStats schedulerStats;
+uint32_t lastRenderedClockStamp = 0xFFFFFFFFUL;
+unsigned long lastClientServiceUs = 0;
 uint8_t currentAppliedBrightness = 0;
+uint8_t currentColorTemperature = 255;  // level of the colour temperature scale, 255 = neutral
 unsigned long lastNtpSyncMs = 0;
 unsigned long lastNtpAttemptMs = 0;
 
-Adafruit_NeoPixel strip(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
+// SNTP client polled from loop(): every state returns immediately, waits are timeouts.
+// A sync round samples each configured server in turn, then filters the samples.
+enum class NtpState : uint8_t { Idle, Resolving, Waiting };
+
+struct NtpServerState {
+  IPAddress address;
+  bool resolved{false};
+  unsigned long resolvedMs{0};  // DNS cache entry age, reused for NTP_DNS_CACHE_TTL_MS
+  uint32_t lookups{0};
+  uint32_t cacheHits{0};
+  uint32_t samples{0};
+  uint32_t failures{0};
+  uint32_t rejected{0};
+  int64_t lastOffsetMs{0};
+  uint32_t lastRttMs{0};
+  uint32_t minRttMs{UINT32_MAX};
+  bool selected{false};  // contributed to the last filtered offset
+};
+
+struct NtpSample {
+  uint8_t server;
+  int64_t offsetMs;  // server time minus the local time base
+  uint32_t rttMs;
+};
+
+struct NtpClient {
+  NtpState state{NtpState::Idle};
+  WiFiUDP udp;
+  bool udpOpen{false};
+  uint32_t generation{0};  // tags DNS callbacks so a stale lookup cannot complete a newer one
+  volatile bool dnsDone{false};
+  bool dnsOk{false};
+  IPAddress dnsResult;
+  uint8_t serverIndex{0};
+  uint8_t serverSamples{0};
+  unsigned long stateStartMs{0};
+  NtpExchange exchange;
+  uint64_t requestSentLocalMs{0};
+  NtpServerState servers[MAX_NTP_SERVERS];
+  NtpSample samples[MAX_NTP_SERVERS * NTP_SAMPLES_PER_SERVER];
+  uint8_t sampleCount{0};
+  const char *lastResult{"none"};
+  uint32_t successes{0};
+  uint32_t failures{0};
+  uint32_t timeouts{0};
+  uint32_t lastRttMs{0};
+  int64_t lastOffsetMs{0};
+  uint8_t lastSamplesUsed{0};
+  uint32_t maxServiceUs{0};
+};
+
+NtpClient ntpClient;
+
+// LAN phase sync: a leader multicasts its epoch time, followers slew their time base onto it so
+// every clock of the room flips its digits together.
+struct FleetSync {
+  WiFiUDP udp;
+  bool open{false};
+  IPAddress group;
+  uint16_t sequence{0};
+  unsigned long lastSendMs{0};
+  uint32_t leaderId{0};
+  IPAddress leaderIp;
+  bool leaderSynced{false};
+  unsigned long lastBeaconMs{0};
+  FleetWindow window;
+  uint32_t beaconsSent{0};
+  uint32_t beaconsReceived{0};
+  uint32_t beaconsIgnored{0};
+  uint32_t alignments{0};
+  uint32_t steps{0};
+  int32_t lastOffsetMs{0};
+  int32_t lastCorrectionMs{0};
+};
+
+FleetSync fleet;
+
+// Copy of the last frame pushed to the strip, used to skip show() when nothing changed.
+struct FrameStats {
+  uint32_t pushed{0};
+  uint32_t skipped{0};
+  uint32_t deferred{0};
+  uint32_t lastShowUs{0};
+  uint32_t maxShowUs{0};
+  uint32_t lastRenderUs{0};
+  uint32_t maxRenderUs{0};
+  uint32_t overBudget{0};
+  uint32_t allocatingFrames{0};  // frames that called malloc/realloc, should stay 0
+  uint32_t lastAllocations{0};   // allocation calls made by the last such frame
+  uint32_t minFreeHeap{UINT32_MAX};
+};
+
+DisplayLayout activeLayout = COMPILED_LAYOUT;
+LayoutRuns layoutRuns = compileLayout(COMPILED_LAYOUT);
+bool layoutFromFile = false;
+
+uint8_t outputFrame[MAX_FRAME_BYTES];
+uint8_t shadowFrame[MAX_FRAME_BYTES];
+bool shadowFrameValid = false;
+FrameStats frameStats;
+
+#if LED_OUTPUT_BACKEND == LED_OUTPUT_I2S_DMA
+I2sDmaLedOutput ledOutputDriver;
+#elif LED_OUTPUT_BACKEND == LED_OUTPUT_RECORDING
+RecordingLedOutput ledOutputDriver;
+#else
+NeoPixelLedOutput ledOutputDriver(COMPILED_LAYOUT.ledCount, LED_PIN);
+#endif
+LedOutput &ledOutput = ledOutputDriver;
 ESP8266WebServer server(80);
 WiFiManager wifiManager;
 SinricProLight *sinricLightDevice = nullptr;
 bool sinricInitialized = false;
-bool sinricCommandInProgress = false;
 
-bool syncTimeFromNtp();
+uint32_t crc32(const uint8_t *data, size_t length);
+bool startNtpSync();
+void serviceNtp();
+const char *ntpStateToString(NtpState state);
+void applyFleetConfig();
+bool isFleetLocked();
 void setupSinric();
 void processSinric();
 void notifySinricState();
@@ -184,14 +806,10 @@ String colorToHex(const Color &color) {
   return String(buffer);
 }
 
-uint32_t asPixelColor(const Color &color) {
-  return strip.Color(color.r, color.g, color.b);
-}
-
 void attachCorsHeaders() {
   server.sendHeader("Access-Control-Allow-Origin", "*");
   server.sendHeader("Access-Control-Allow-Headers", "Content-Type");
-  server.sendHeader("Access-Control-Allow-Methods", "GET,POST,OPTIONS");
+  server.sendHeader("Access-Control-Allow-Methods", "GET,POST,PATCH,DELETE,OPTIONS");
 }
 
 void sendJson(const JsonDocument &doc, int code = 200) {
@@ -207,30 +825,29 @@ void sendJsonError(const String &message, int code = 400) {
   sendJson(doc, code);
 }
 
-OperatingMode modeFromString(String value) {
-  value.toLowerCase();
-  if (value == "clock") {
+OperatingMode modeFromString(const char *value) {
+  if (value == nullptr) {
     return OperatingMode::Clock;
   }
-  if (value == "timer") {
+  if (strcasecmp(value, "timer") == 0) {
     return OperatingMode::Timer;
   }
-  if (value == "weather") {
+  if (strcasecmp(value, "weather") == 0) {
     return OperatingMode::Weather;
   }
-  if (value == "custom") {
+  if (strcasecmp(value, "custom") == 0) {
     return OperatingMode::Custom;
   }
-  if (value == "alarm") {
+  if (strcasecmp(value, "alarm") == 0) {
     return OperatingMode::Alarm;
   }
-  if (value == "off") {
+  if (strcasecmp(value, "off") == 0) {
     return OperatingMode::Off;
   }
   return OperatingMode::Clock;
 }
 
-String modeToString(OperatingMode mode) {
+const char *modeToString(OperatingMode mode) {
   switch (mode) {
     case OperatingMode::Clock:
       return "clock";
@@ -248,498 +865,3327 @@ String modeToString(OperatingMode mode) {
   return "clock";
 }
 
-String sanitizeMode(const String &value) {
-  return modeToString(modeFromString(value));
+// Copies text into a fixed config buffer and zero-fills the tail, so equal settings always give
+// equal snapshots. Returns false, leaving the buffer untouched, when the text does not fit.
+template <size_t N>
+bool setText(char (&dest)[N], const char *value) {
+  if (strlen(value) >= N) {
+    return false;
+  }
+  strncpy(dest, value, N);
+  return true;
 }
 
-TimeSettings computeCurrentTime();
-void applyDisplaySettingsWithTime(const TimeSettings &time);
-void stopAlarm();
-bool isAlarmScheduledToday(uint8_t weekday);
-uint8_t computeWeekdayFromSeconds(uint32_t seconds);
+// Scalar config fields, described once. The JSON import/export, the section GET/POST handlers
+// and PATCH /api/config all read and write these through readConfigFields()/writeConfigFields();
+// adding a field is one line here. Lists, effects, schedules and free text keep dedicated code.
+enum class FieldType : uint8_t { Bool, U8, U16, I16, Color, Mode };
+
+// Side effects of a config change, run once per loop iteration by applyCommands().
+enum ApplyEffect : uint8_t {
+  APPLY_REFRESH = 1 << 0,       // redraw the display
+  APPLY_DISPLAY = 1 << 1,       // recompute brightness and colours
+  APPLY_SINRIC_STATE = 1 << 2,  // report the new state to Sinric Pro
+  APPLY_TIME_ZONE = 1 << 3,     // rebuild the time zone rules
+  APPLY_FLEET = 1 << 4,         // reopen the fleet socket
+  APPLY_SINRIC_SETUP = 1 << 5,  // reconnect to Sinric Pro
+  APPLY_PERSIST = 1 << 6,       // schedule a config write
+};
 
-void applyDisplaySettings() {
-  applyDisplaySettingsWithTime(computeCurrentTime());
-}
+struct FieldDescriptor {
+  const char *section;  // top-level object of config.json, also the API resource
+  const char *object;   // nested object inside the section, or nullptr
+  const char *name;
+  FieldType type;
+  int32_t minValue;
+  int32_t maxValue;
+  uint16_t offset;  // into ClockConfig
+  uint8_t effects;
+};
 
-void loadDefaultConfig() {
-  config.power = PowerSettings();
-  config.time = TimeSettings();
-  config.display = DisplaySettings();
-  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-    config.display.perDigitColor[i] = config.display.generalColor;
-  }
-  config.dots = DotsSettings();
-  config.alarm = AlarmSettings();
-  config.network = NetworkSettings();
-  config.sinric = SinricSettings();
+// The field type follows the member's C++ type, so the table cannot disagree with ClockConfig.
+template <typename T>
+constexpr FieldType fieldTypeOf();
+template <>
+constexpr FieldType fieldTypeOf<bool>() {
+  return FieldType::Bool;
+}
+template <>
+constexpr FieldType fieldTypeOf<uint8_t>() {
+  return FieldType::U8;
+}
+template <>
+constexpr FieldType fieldTypeOf<uint16_t>() {
+  return FieldType::U16;
+}
+template <>
+constexpr FieldType fieldTypeOf<int16_t>() {
+  return FieldType::I16;
+}
+template <>
+constexpr FieldType fieldTypeOf<Color>() {
+  return FieldType::Color;
+}
+template <>
+constexpr FieldType fieldTypeOf<OperatingMode>() {
+  return FieldType::Mode;
 }
 
-bool saveConfig() {
-  if (!LittleFS.begin()) {
-    return false;
-  }
-  File file = LittleFS.open(CONFIG_PATH, "w");
-  if (!file) {
-    return false;
-  }
-  JsonDocument doc;
-  JsonObject power = doc["power"].to<JsonObject>();
-  power["power_on"] = config.power.powerOn;
-  power["startup_mode"] = config.power.startupMode;
-  power["mode"] = config.power.mode;
-  power["exit_special_mode"] = config.power.exitSpecialMode;
-
-  JsonObject display = doc["display"].to<JsonObject>();
-  display["brightness"] = config.display.brightness;
-  display["general_color"] = colorToHex(config.display.generalColor);
-  JsonObject perDigit = display["per_digit_color"].to<JsonObject>();
-  perDigit["enabled"] = config.display.perDigitEnabled;
-  JsonArray perDigitValues = perDigit["values"].to<JsonArray>();
-  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-    perDigitValues.add(colorToHex(config.display.perDigitColor[i]));
-  }
-  JsonObject quiet = display["quiet_hours"].to<JsonObject>();
-  quiet["enabled"] = config.display.quietHours.enabled;
-  quiet["start_hour"] = config.display.quietHours.startHour;
-  quiet["start_minute"] = config.display.quietHours.startMinute;
-  quiet["end_hour"] = config.display.quietHours.endHour;
-  quiet["end_minute"] = config.display.quietHours.endMinute;
-  quiet["dim_brightness"] = config.display.quietHours.dimBrightness;
-
-  JsonObject dots = doc["dots"].to<JsonObject>();
-  dots["enabled"] = config.dots.enabled;
-  dots["left_color"] = colorToHex(config.dots.leftColor);
-  dots["right_color"] = colorToHex(config.dots.rightColor);
-  dots["force_override"] = config.dots.forceOverride;
-  dots["forced_color"] = colorToHex(config.dots.forcedColor);
-
-  JsonObject alarm = doc["alarm"].to<JsonObject>();
-  alarm["enabled"] = config.alarm.enabled;
-  alarm["hour"] = config.alarm.hour;
-  alarm["minute"] = config.alarm.minute;
-  alarm["days_mask"] = config.alarm.daysMask;
-  alarm["duration_ms"] = config.alarm.durationMs;
-
-  JsonObject network = doc["network"].to<JsonObject>();
-  network["ntp_server"] = config.network.ntpServer;
-  network["utc_offset_minutes"] = config.network.utcOffsetMinutes;
+#define CONFIG_FIELD(section, object, name, minValue, maxValue, member, effects)                             \
+  {section, object, name, fieldTypeOf<decltype(std::declval<ClockConfig &>().member)>(), minValue, maxValue, \
+   offsetof(ClockConfig, member), effects}
+
+constexpr FieldDescriptor CONFIG_FIELDS[] = {
+    CONFIG_FIELD("power", nullptr, "power_on", 0, 1, power.powerOn, APPLY_REFRESH | APPLY_SINRIC_STATE),
+    CONFIG_FIELD("power", nullptr, "mode", 0, 0, power.mode, APPLY_REFRESH | APPLY_SINRIC_STATE),
+    CONFIG_FIELD("power", nullptr, "startup_mode", 0, 0, power.startupMode, 0),
+    CONFIG_FIELD("display", nullptr, "brightness", 1, 255, display.brightness,
+                 APPLY_DISPLAY | APPLY_REFRESH | APPLY_SINRIC_STATE),
+    CONFIG_FIELD("display", nullptr, "general_color", 0, 0, display.generalColor,
+                 APPLY_DISPLAY | APPLY_REFRESH | APPLY_SINRIC_STATE),
+    CONFIG_FIELD("display", "per_digit_color", "enabled", 0, 1, display.perDigitEnabled,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", nullptr, "transition_ms", 0, 2000, display.transitionMs, 0),
+    CONFIG_FIELD("display", nullptr, "gamma_correction", 0, 1, display.gammaCorrection,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", nullptr, "dithering", 0, 1, display.dithering, APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "enabled", 0, 1, display.quietHours.enabled,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "start_hour", 0, 23, display.quietHours.startHour,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "start_minute", 0, 59, display.quietHours.startMinute,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "end_hour", 0, 23, display.quietHours.endHour,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "end_minute", 0, 59, display.quietHours.endMinute,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("display", "quiet_hours", "dim_brightness", 0, 255, display.quietHours.dimBrightness,
+                 APPLY_DISPLAY | APPLY_REFRESH),
+    CONFIG_FIELD("dots", nullptr, "enabled", 0, 1, dots.enabled, APPLY_REFRESH),
+    CONFIG_FIELD("dots", nullptr, "left_color", 0, 0, dots.leftColor, APPLY_REFRESH),
+    CONFIG_FIELD("dots", nullptr, "right_color", 0, 0, dots.rightColor, APPLY_REFRESH),
+    CONFIG_FIELD("dots", nullptr, "force_override", 0, 1, dots.forceOverride, APPLY_REFRESH),
+    CONFIG_FIELD("dots", nullptr, "forced_color", 0, 0, dots.forcedColor, APPLY_REFRESH),
+    CONFIG_FIELD("network", nullptr, "utc_offset_minutes", -720, 840, network.utcOffsetMinutes,
+                 APPLY_TIME_ZONE | APPLY_REFRESH),  // -12h to +14h
+    CONFIG_FIELD("network", "fleet", "port", 1024, 65535, network.fleetPort, APPLY_FLEET),
+    CONFIG_FIELD("sinric", nullptr, "enabled", 0, 1, sinric.enabled, APPLY_SINRIC_SETUP),
+};
 
-  JsonObject sinric = doc["sinric"].to<JsonObject>();
-  sinric["enabled"] = config.sinric.enabled;
-  sinric["app_key"] = config.sinric.appKey;
-  sinric["app_secret"] = config.sinric.appSecret;
-  sinric["device_id"] = config.sinric.deviceId;
+#undef CONFIG_FIELD
 
-  bool ok = serializeJsonPretty(doc, file) > 0;
-  file.close();
-  return ok;
+template <typename T>
+T &fieldRef(const FieldDescriptor &field) {
+  return *reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(&config) + field.offset);
 }
 
-bool loadConfig() {
-  if (!LittleFS.begin()) {
-    LittleFS.format();
-    if (!LittleFS.begin()) {
+bool isHexColor(const char *value) {
+  if (value == nullptr || strlen(value) != 7 || value[0] != '#') {
+    return false;
+  }
+  for (uint8_t i = 1; i < 7; ++i) {
+    if (!isxdigit(static_cast<unsigned char>(value[i]))) {
       return false;
     }
   }
+  return true;
+}
 
-  if (!LittleFS.exists(CONFIG_PATH)) {
-    loadDefaultConfig();
-    saveConfig();
-    return true;
-  }
-
-  File file = LittleFS.open(CONFIG_PATH, "r");
-  if (!file) {
-    loadDefaultConfig();
-    return false;
+void writeConfigField(JsonObject target, const FieldDescriptor &field) {
+  switch (field.type) {
+    case FieldType::Bool:
+      target[field.name] = fieldRef<bool>(field);
+      break;
+    case FieldType::U8:
+      target[field.name] = fieldRef<uint8_t>(field);
+      break;
+    case FieldType::U16:
+      target[field.name] = fieldRef<uint16_t>(field);
+      break;
+    case FieldType::I16:
+      target[field.name] = fieldRef<int16_t>(field);
+      break;
+    case FieldType::Color:
+      target[field.name] = colorToHex(fieldRef<Color>(field));
+      break;
+    case FieldType::Mode:
+      target[field.name] = modeToString(fieldRef<OperatingMode>(field));
+      break;
   }
+}
 
-  JsonDocument doc;
-  DeserializationError err = deserializeJson(doc, file);
-  file.close();
-  if (err) {
-    loadDefaultConfig();
-    saveConfig();
+template <typename T>
+bool storeField(const FieldDescriptor &field, T value) {
+  T &target = fieldRef<T>(field);
+  if (target == value) {
     return false;
   }
+  target = value;
+  return true;
+}
 
-  JsonObject power = doc["power"].as<JsonObject>();
-  if (!power.isNull()) {
-    config.power.powerOn = power["power_on"].as<bool>();
-    config.power.startupMode = sanitizeMode(power["startup_mode"].as<String>());
-    config.power.mode = sanitizeMode(power["mode"].as<String>());
-    config.power.exitSpecialMode = false;
+// Strict check used by PATCH: right JSON type, number in range, known mode, #RRGGBB colour.
+bool isValidFieldValue(JsonVariantConst value, const FieldDescriptor &field) {
+  switch (field.type) {
+    case FieldType::Bool:
+      return value.is<bool>();
+    case FieldType::U8:
+    case FieldType::U16:
+    case FieldType::I16:
+      return value.is<long>() && value.as<long>() >= field.minValue && value.as<long>() <= field.maxValue;
+    case FieldType::Color:
+      return isHexColor(value.as<const char *>());
+    case FieldType::Mode:
+      return value.is<const char *>() &&
+             strcasecmp(modeToString(modeFromString(value.as<const char *>())), value.as<const char *>()) == 0;
   }
+  return false;
+}
 
-  JsonObject display = doc["display"].as<JsonObject>();
-  if (!display.isNull()) {
-    config.display.brightness = constrain(display["brightness"].as<int>(), 1, 255);
-    config.display.generalColor = hexToColor(display["general_color"].as<String>(), config.display.generalColor);
+enum class FieldUpdate : uint8_t { Unchanged, Changed, Invalid };
 
-    JsonObject perDigit = display["per_digit_color"].as<JsonObject>();
-    if (!perDigit.isNull()) {
-      config.display.perDigitEnabled = perDigit["enabled"].as<bool>();
-      JsonArray values = perDigit["values"].as<JsonArray>();
-      for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-        if (!values.isNull() && i < values.size()) {
-          config.display.perDigitColor[i] = hexToColor(values[i].as<String>(), config.display.generalColor);
-        } else {
-          config.display.perDigitColor[i] = config.display.generalColor;
-        }
+// Strict updates (PATCH) reject invalid values; the section handlers and the JSON import clamp
+// numbers and keep the old colour on a malformed one, as they always did.
+FieldUpdate readConfigField(JsonVariantConst value, const FieldDescriptor &field, bool strict) {
+  if (strict && !isValidFieldValue(value, field)) {
+    return FieldUpdate::Invalid;
+  }
+  bool changed = false;
+  switch (field.type) {
+    case FieldType::Bool:
+      changed = storeField(field, value.as<bool>());
+      break;
+    case FieldType::U8:
+    case FieldType::U16:
+    case FieldType::I16: {
+      const long number = value.as<long>();
+      const long clamped = constrain(number, static_cast<long>(field.minValue), static_cast<long>(field.maxValue));
+      if (field.type == FieldType::U8) {
+        changed = storeField(field, static_cast<uint8_t>(clamped));
+      } else if (field.type == FieldType::U16) {
+        changed = storeField(field, static_cast<uint16_t>(clamped));
+      } else {
+        changed = storeField(field, static_cast<int16_t>(clamped));
       }
+      break;
     }
-    JsonObject quiet = display["quiet_hours"].as<JsonObject>();
-    if (!quiet.isNull()) {
-      config.display.quietHours.enabled = quiet["enabled"].as<bool>();
-      config.display.quietHours.startHour = constrain(quiet["start_hour"].as<int>(), 0, 23);
-      config.display.quietHours.startMinute = constrain(quiet["start_minute"].as<int>(), 0, 59);
-      config.display.quietHours.endHour = constrain(quiet["end_hour"].as<int>(), 0, 23);
-      config.display.quietHours.endMinute = constrain(quiet["end_minute"].as<int>(), 0, 59);
-      config.display.quietHours.dimBrightness =
-          constrain(quiet["dim_brightness"].as<int>(), 0, 255);
+    case FieldType::Color: {
+      const char *text = value.as<const char *>();
+      if (!isHexColor(text)) {
+        return FieldUpdate::Unchanged;
+      }
+      Color &target = fieldRef<Color>(field);
+      const Color color = hexToColor(text, target);
+      changed = color.r != target.r || color.g != target.g || color.b != target.b;
+      target = color;
+      break;
     }
+    case FieldType::Mode:
+      changed = storeField(field, modeFromString(value.as<const char *>()));
+      break;
   }
+  return changed ? FieldUpdate::Changed : FieldUpdate::Unchanged;
+}
 
-  JsonObject dots = doc["dots"].as<JsonObject>();
-  if (!dots.isNull()) {
-    config.dots.enabled = dots["enabled"].as<bool>();
-    config.dots.leftColor = hexToColor(dots["left_color"].as<String>(), config.dots.leftColor);
-    config.dots.rightColor = hexToColor(dots["right_color"].as<String>(), config.dots.rightColor);
-    if (!dots["force_override"].isNull()) {
-      config.dots.forceOverride = dots["force_override"].as<bool>();
-    }
-    config.dots.forcedColor = hexToColor(dots["forced_color"].as<String>(), config.dots.forcedColor);
+bool isFieldInScope(const FieldDescriptor &field, const char *section, const char *object) {
+  if (strcmp(field.section, section) != 0) {
+    return false;
   }
+  return field.object == nullptr ? object == nullptr : object != nullptr && strcmp(field.object, object) == 0;
+}
 
-  JsonObject alarm = doc["alarm"].as<JsonObject>();
-  if (!alarm.isNull()) {
-    config.alarm.enabled = alarm["enabled"].as<bool>();
-    config.alarm.hour = constrain(alarm["hour"].as<int>(), 0, 23);
-    config.alarm.minute = constrain(alarm["minute"].as<int>(), 0, 59);
-    if (!alarm["days_mask"].isNull()) {
-      config.alarm.daysMask = alarm["days_mask"].as<uint8_t>();
-    }
-    if (!alarm["duration_ms"].isNull()) {
-      uint32_t duration = alarm["duration_ms"].as<uint32_t>();
-      config.alarm.durationMs = constrain(duration, 1000UL, 30UL * 60UL * 1000UL);
+const FieldDescriptor *findConfigField(const char *section, const char *object, const char *name) {
+  for (const FieldDescriptor &field : CONFIG_FIELDS) {
+    if (isFieldInScope(field, section, object) && strcmp(field.name, name) == 0) {
+      return &field;
     }
   }
+  return nullptr;
+}
 
-  JsonObject network = doc["network"].as<JsonObject>();
-  if (!network.isNull()) {
-    String ntp = network["ntp_server"].as<String>();
-    if (ntp.length() > 0) {
-      config.network.ntpServer = ntp;
-    }
-    if (!network["utc_offset_minutes"].isNull()) {
-      config.network.utcOffsetMinutes =
-          constrain(network["utc_offset_minutes"].as<int>(), -720, 840);  // -12h to +14h
+// Writes the fields of section (or of one of its nested objects) into target, which is that
+// object itself.
+void writeConfigFields(JsonObject target, const char *section, const char *object = nullptr) {
+  for (const FieldDescriptor &field : CONFIG_FIELDS) {
+    if (isFieldInScope(field, section, object)) {
+      writeConfigField(target, field);
     }
   }
+}
 
-  JsonObject sinric = doc["sinric"].as<JsonObject>();
-  if (!sinric.isNull()) {
-    if (!sinric["enabled"].isNull()) {
-      config.sinric.enabled = sinric["enabled"].as<bool>();
-    }
-    if (!sinric["app_key"].isNull()) {
-      config.sinric.appKey = sinric["app_key"].as<String>();
-    }
-    if (!sinric["app_secret"].isNull()) {
-      config.sinric.appSecret = sinric["app_secret"].as<String>();
+// Applies the fields present in source and returns the effects of the ones that changed.
+uint8_t readConfigFields(JsonObjectConst source, const char *section, const char *object = nullptr) {
+  uint8_t effects = 0;
+  if (source.isNull()) {
+    return effects;
+  }
+  for (const FieldDescriptor &field : CONFIG_FIELDS) {
+    if (!isFieldInScope(field, section, object)) {
+      continue;
     }
-    if (!sinric["device_id"].isNull()) {
-      config.sinric.deviceId = sinric["device_id"].as<String>();
+    JsonVariantConst value = source[field.name];
+    if (!value.isNull() && readConfigField(value, field, false) == FieldUpdate::Changed) {
+      effects |= field.effects;
     }
   }
+  return effects;
+}
 
-  return true;
+FleetRole fleetRoleFromString(String value) {
+  value.toLowerCase();
+  if (value == "leader") {
+    return FleetRole::Leader;
+  }
+  if (value == "follower") {
+    return FleetRole::Follower;
+  }
+  return FleetRole::Off;
 }
 
-uint32_t timeToSeconds(const TimeSettings &time) {
-  return static_cast<uint32_t>(time.hour) * 3600UL + static_cast<uint32_t>(time.minute) * 60UL + time.second;
+const char *fleetRoleToString(FleetRole role) {
+  switch (role) {
+    case FleetRole::Leader:
+      return "leader";
+    case FleetRole::Follower:
+      return "follower";
+    case FleetRole::Off:
+      break;
+  }
+  return "off";
 }
 
-TimeSettings secondsToTime(uint32_t seconds) {
-  seconds %= 24UL * 3600UL;
-  TimeSettings result;
-  result.hour = seconds / 3600UL;
-  seconds %= 3600UL;
-  result.minute = seconds / 60UL;
-  result.second = seconds % 60UL;
-  return result;
+EffectKind effectFromString(String value) {
+  value.toLowerCase();
+  if (value == "gradient") {
+    return EffectKind::Gradient;
+  }
+  if (value == "rainbow") {
+    return EffectKind::Rainbow;
+  }
+  if (value == "breathing") {
+    return EffectKind::Breathing;
+  }
+  if (value == "animation") {
+    return EffectKind::Animation;
+  }
+  return EffectKind::None;
 }
 
-TimeSettings computeCurrentTime() {
-  uint32_t elapsed = (millis() - timeReferenceMs) / 1000UL;
-  uint32_t anchorSeconds = timeToSeconds(timeAnchor);
-  return secondsToTime(anchorSeconds + elapsed);
+const char *effectToString(EffectKind effect) {
+  switch (effect) {
+    case EffectKind::Gradient:
+      return "gradient";
+    case EffectKind::Rainbow:
+      return "rainbow";
+    case EffectKind::Breathing:
+      return "breathing";
+    case EffectKind::Animation:
+      return "animation";
+    case EffectKind::None:
+    case EffectKind::Count:
+      break;
+  }
+  return "none";
 }
 
-uint16_t minutesFromComponents(uint8_t hour, uint8_t minute) {
-  return static_cast<uint16_t>(hour) * 60 + static_cast<uint16_t>(minute);
+void writeEffectJson(JsonObject target) {
+  target["name"] = effectToString(config.display.effect.kind);
+  target["speed"] = config.display.effect.speed;
+  target["secondary_color"] = colorToHex(config.display.effect.secondaryColor);
 }
 
-bool isInRangeWrap(uint16_t current, uint16_t start, uint16_t end) {
-  if (start == end) {
-    return true;
+void readEffectJson(JsonObject source) {
+  if (!source["name"].isNull()) {
+    config.display.effect.kind = effectFromString(source["name"].as<String>());
   }
-  if (start < end) {
+  if (!source["speed"].isNull()) {
+    config.display.effect.speed = constrain(source["speed"].as<int>(), 1, 255);
+  }
+  if (!source["secondary_color"].isNull()) {
+    config.display.effect.secondaryColor =
+        hexToColor(source["secondary_color"].as<String>(), config.display.effect.secondaryColor);
+  }
+}
+
+void writeScheduleJson(JsonObject target) {
+  const DisplaySettings::BrightnessSchedule &schedule = config.display.schedule;
+  target["enabled"] = schedule.enabled;
+  JsonArray points = target["points"].to<JsonArray>();
+  for (uint8_t i = 0; i < schedule.count; ++i) {
+    JsonObject point = points.add<JsonObject>();
+    point["hour"] = schedule.points[i].minute / 60;
+    point["minute"] = schedule.points[i].minute % 60;
+    point["brightness"] = schedule.points[i].brightness;
+    point["kelvin"] = schedule.points[i].kelvin;
+    point["fade"] = schedule.points[i].fade;
+  }
+}
+
+// A points array replaces the whole list; false when it holds too many points.
+bool readScheduleJson(JsonObject source) {
+  DisplaySettings::BrightnessSchedule &schedule = config.display.schedule;
+  JsonArray points = source["points"].as<JsonArray>();
+  if (!points.isNull()) {
+    if (points.size() > MAX_SCHEDULE_POINTS) {
+      return false;
+    }
+    schedule.count = 0;
+    for (JsonObject entry : points) {
+      DisplaySettings::SchedulePoint &point = schedule.points[schedule.count++];
+      point = DisplaySettings::SchedulePoint();
+      point.minute = static_cast<uint16_t>(constrain(entry["hour"].as<int>(), 0, 23) * 60 +
+                                           constrain(entry["minute"].as<int>(), 0, 59));
+      if (!entry["brightness"].isNull()) {
+        point.brightness = constrain(entry["brightness"].as<int>(), 0, 255);
+      }
+      if (!entry["kelvin"].isNull()) {
+        point.kelvin = constrain(entry["kelvin"].as<int>(), COLOR_TEMPERATURE_MIN_K, COLOR_TEMPERATURE_NEUTRAL_K);
+      }
+      if (!entry["fade"].isNull()) {
+        point.fade = entry["fade"].as<bool>();
+      }
+    }
+  }
+  if (!source["enabled"].isNull()) {
+    schedule.enabled = source["enabled"].as<bool>();
+  }
+  return true;
+}
+
+TimeSettings computeCurrentTime();
+void applyDisplaySettingsWithTime(const TimeSettings &time);
+void stopAlarm();
+
+void applyDisplaySettings() {
+  applyDisplaySettingsWithTime(computeCurrentTime());
+}
+
+void invalidateAlarmIndex() {
+  alarmState.indexValid = false;
+}
+
+void writeAlarmJson(JsonObject target, const AlarmEntry &alarm) {
+  target["enabled"] = alarm.enabled;
+  target["hour"] = alarm.hour;
+  target["minute"] = alarm.minute;
+  target["days_mask"] = alarm.daysMask;
+  target["duration_ms"] = alarm.durationMs;
+  target["color"] = colorToHex(alarm.color);
+  target["sunrise_minutes"] = alarm.sunriseMinutes;
+  target["snooze_minutes"] = alarm.snoozeMinutes;
+}
+
+void readAlarmJson(JsonObject source, AlarmEntry &alarm) {
+  if (!source["enabled"].isNull()) {
+    alarm.enabled = source["enabled"].as<bool>();
+  }
+  if (!source["hour"].isNull()) {
+    alarm.hour = constrain(source["hour"].as<int>(), 0, 23);
+  }
+  if (!source["minute"].isNull()) {
+    alarm.minute = constrain(source["minute"].as<int>(), 0, 59);
+  }
+  if (!source["days_mask"].isNull()) {
+    alarm.daysMask = source["days_mask"].as<uint8_t>() & 0x7F;
+  }
+  if (!source["duration_ms"].isNull()) {
+    uint32_t duration = source["duration_ms"].as<uint32_t>();
+    alarm.durationMs = constrain(duration, 1000UL, 30UL * 60UL * 1000UL);
+  }
+  if (!source["color"].isNull()) {
+    alarm.color = hexToColor(source["color"].as<String>(), alarm.color);
+  }
+  if (!source["sunrise_minutes"].isNull()) {
+    alarm.sunriseMinutes = constrain(source["sunrise_minutes"].as<int>(), 0, MAX_SUNRISE_MINUTES);
+  }
+  if (!source["snooze_minutes"].isNull()) {
+    alarm.snoozeMinutes = constrain(source["snooze_minutes"].as<int>(), 1, 30);
+  }
+}
+
+// Replaces the whole list; entries start from the defaults so partial objects are accepted.
+bool readAlarmListJson(JsonVariant value) {
+  JsonArray list = value.as<JsonArray>();
+  if (list.isNull() || list.size() > MAX_ALARMS) {
+    return false;
+  }
+  config.alarm.count = 0;
+  for (JsonObject entry : list) {
+    AlarmEntry &alarm = config.alarm.entries[config.alarm.count++];
+    alarm = AlarmEntry();
+    readAlarmJson(entry, alarm);
+  }
+  if (config.alarm.count == 0) {
+    config.alarm.entries[0] = AlarmEntry();
+    config.alarm.count = 1;  // keep the slot the web UI edits
+  }
+  return true;
+}
+
+bool isMulticastGroup(const String &value) {
+  IPAddress address;
+  if (!address.fromString(value.c_str())) {
+    return false;
+  }
+  return address[0] >= 224 && address[0] <= 239;
+}
+
+// False, with nothing applied, when the group is not a multicast address.
+bool readFleetJson(JsonObject source) {
+  const bool groupGiven = !source["group"].isNull();
+  const String group = groupGiven ? source["group"].as<String>() : String();
+  if (groupGiven && (!isMulticastGroup(group) || group.length() >= CONFIG_ADDRESS_BYTES)) {
+    return false;
+  }
+  if (!source["role"].isNull()) {
+    config.network.fleetRole = fleetRoleFromString(source["role"].as<String>());
+  }
+  readConfigFields(source, "network", "fleet");
+  if (groupGiven) {
+    setText(config.network.fleetGroup, group.c_str());
+  }
+  return true;
+}
+
+void resetNtpServerState(uint8_t index);
+
+bool isValidNtpServerName(const String &name) {
+  return name.length() > 0 && name.length() < CONFIG_HOSTNAME_BYTES;
+}
+
+// All or nothing: the list is checked before any slot changes, so a rejected list leaves the
+// running servers and their state untouched.
+bool setNtpServers(const String *names, uint8_t count) {
+  if (count == 0 || count > MAX_NTP_SERVERS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    if (!isValidNtpServerName(names[i])) {
+      return false;
+    }
+  }
+  config.network.ntpServerCount = count;
+  for (uint8_t slot = 0; slot < count; ++slot) {
+    if (strcmp(config.network.ntpServers[slot], names[slot].c_str()) != 0) {
+      setText(config.network.ntpServers[slot], names[slot].c_str());
+      resetNtpServerState(slot);
+    }
+  }
+  return true;
+}
+
+bool readNtpServersJson(JsonVariant value) {
+  JsonArray list = value.as<JsonArray>();
+  if (list.isNull() || list.size() == 0 || list.size() > MAX_NTP_SERVERS) {
+    return false;
+  }
+  String names[MAX_NTP_SERVERS];
+  uint8_t count = 0;
+  for (JsonVariant entry : list) {
+    names[count++] = entry.as<String>();
+  }
+  return setNtpServers(names, count);
+}
+
+void loadDefaultConfig() {
+  config.power = PowerSettings();
+  config.time = TimeSettings();
+  config.display = DisplaySettings();
+  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
+    config.display.perDigitColor[i] = config.display.generalColor;
+  }
+  config.dots = DotsSettings();
+  config.alarm = AlarmSettings();
+  invalidateAlarmIndex();
+  config.network = NetworkSettings();
+  config.sinric = SinricSettings();
+}
+
+// Config writes are deferred: handlers only mark the config dirty and the loop flushes it once the
+// changes stop, so a slider drag costs one flash write instead of dozens.
+struct ConfigPersistence {
+  bool mounted{false};
+  bool dirty{false};
+  unsigned long firstChangeMs{0};
+  unsigned long lastChangeMs{0};
+  bool storedValid{false};
+  uint32_t storedCrc{0};
+  int8_t activeSlot{-1};  // slot holding the newest valid record
+  uint32_t sequence{0};
+  const char *loadedFrom{"defaults"};
+  uint32_t loadUs{0};
+  uint32_t requests{0};
+  uint32_t writes{0};
+  uint32_t unchanged{0};
+  uint32_t failures{0};
+  uint32_t bytesWritten{0};
+  uint32_t lastWriteUs{0};
+  uint32_t maxWriteUs{0};
+};
+
+ConfigPersistence configStore;
+
+void serializeConfig(String &out) {
+  JsonDocument doc;
+  JsonObject power = doc["power"].to<JsonObject>();
+  writeConfigFields(power, "power");
+  power["exit_special_mode"] = config.power.exitSpecialMode;
+
+  JsonObject display = doc["display"].to<JsonObject>();
+  writeConfigFields(display, "display");
+  JsonObject perDigit = display["per_digit_color"].to<JsonObject>();
+  writeConfigFields(perDigit, "display", "per_digit_color");
+  JsonArray perDigitValues = perDigit["values"].to<JsonArray>();
+  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
+    perDigitValues.add(colorToHex(config.display.perDigitColor[i]));
+  }
+  writeEffectJson(display["effect"].to<JsonObject>());
+  writeConfigFields(display["quiet_hours"].to<JsonObject>(), "display", "quiet_hours");
+  writeScheduleJson(display["brightness_schedule"].to<JsonObject>());
+
+  writeConfigFields(doc["dots"].to<JsonObject>(), "dots");
+
+  writeAlarmJson(doc["alarm"].to<JsonObject>(), config.alarm.entries[0]);
+  JsonArray alarms = doc["alarms"].to<JsonArray>();
+  for (uint8_t i = 0; i < config.alarm.count; ++i) {
+    writeAlarmJson(alarms.add<JsonObject>(), config.alarm.entries[i]);
+  }
+
+  JsonObject network = doc["network"].to<JsonObject>();
+  writeConfigFields(network, "network");
+  network["ntp_server"] = config.network.ntpServers[0];
+  JsonArray ntpServers = network["ntp_servers"].to<JsonArray>();
+  for (uint8_t i = 0; i < config.network.ntpServerCount; ++i) {
+    ntpServers.add(config.network.ntpServers[i]);
+  }
+  network["timezone"] = config.network.timezone;
+  JsonObject fleetConfig = network["fleet"].to<JsonObject>();
+  fleetConfig["role"] = fleetRoleToString(config.network.fleetRole);
+  fleetConfig["group"] = config.network.fleetGroup;
+  writeConfigFields(fleetConfig, "network", "fleet");
+
+  JsonObject sinric = doc["sinric"].to<JsonObject>();
+  writeConfigFields(sinric, "sinric");
+  sinric["app_key"] = config.sinric.appKey;
+  sinric["app_secret"] = config.sinric.appSecret;
+  sinric["device_id"] = config.sinric.deviceId;
+
+  serializeJson(doc, out);
+}
+
+// Binary image of the persisted config. Sections keep their in-memory layout; only the modes are
+// stored as text, which keeps the record independent of the enum order. Any layout change needs
+// a new CONFIG_RECORD_VERSION.
+struct ConfigSnapshot {
+  struct Power {
+    bool powerOn;
+    bool exitSpecialMode;
+    char startupMode[CONFIG_MODE_BYTES];
+    char mode[CONFIG_MODE_BYTES];
+  } power;
+  TimeSettings time;
+  DisplaySettings display;
+  DotsSettings dots;
+  AlarmSettings alarm;
+  NetworkSettings network;
+  SinricSettings sinric;
+};
+
+struct ConfigRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t payloadBytes;
+  uint32_t sequence;  // the slot with the highest sequence wins
+  ConfigSnapshot payload;
+  uint32_t crc;  // over everything above
+};
+
+static_assert(std::is_trivially_copyable<ConfigRecord>::value, "config records are copied byte for byte");
+static_assert(sizeof(ConfigSnapshot) <= UINT16_MAX, "payload size must fit the header");
+// Trips on most layout changes; after bumping CONFIG_RECORD_VERSION (and updating the
+// snapshot copies), set the new size here.
+static_assert(sizeof(ConfigSnapshot) == 1072, "config layout changed: bump CONFIG_RECORD_VERSION");
+
+ConfigRecord configRecord;  // static: too large for the loop stack
+
+uint32_t configRecordCrc(const ConfigRecord &record) {
+  return crc32(reinterpret_cast<const uint8_t *>(&record), offsetof(ConfigRecord, crc));
+}
+
+uint32_t configPayloadCrc(const ConfigRecord &record) {
+  return crc32(reinterpret_cast<const uint8_t *>(&record.payload), sizeof(record.payload));
+}
+
+// Display, alarm and network settings contain padding, and whole-struct assignments (defaults,
+// alarm list resets) leave it undefined in config. Those sections are therefore copied member
+// by member into the zeroed snapshot, so unchanged settings always give the same payload CRC.
+void snapshotDisplay(DisplaySettings &to, const DisplaySettings &from) {
+  to.brightness = from.brightness;
+  to.generalColor = from.generalColor;
+  to.perDigitEnabled = from.perDigitEnabled;
+  memcpy(to.perDigitColor, from.perDigitColor, sizeof(to.perDigitColor));
+  to.transitionMs = from.transitionMs;
+  to.gammaCorrection = from.gammaCorrection;
+  to.dithering = from.dithering;
+  to.effect.kind = from.effect.kind;
+  to.effect.speed = from.effect.speed;
+  to.effect.secondaryColor = from.effect.secondaryColor;
+  to.quietHours = from.quietHours;
+  to.schedule.enabled = from.schedule.enabled;
+  for (uint8_t i = 0; i < MAX_SCHEDULE_POINTS; ++i) {
+    to.schedule.points[i].minute = from.schedule.points[i].minute;
+    to.schedule.points[i].brightness = from.schedule.points[i].brightness;
+    to.schedule.points[i].kelvin = from.schedule.points[i].kelvin;
+    to.schedule.points[i].fade = from.schedule.points[i].fade;
+  }
+  to.schedule.count = from.schedule.count;
+}
+
+void snapshotAlarms(AlarmSettings &to, const AlarmSettings &from) {
+  for (uint8_t i = 0; i < MAX_ALARMS; ++i) {
+    to.entries[i].enabled = from.entries[i].enabled;
+    to.entries[i].hour = from.entries[i].hour;
+    to.entries[i].minute = from.entries[i].minute;
+    to.entries[i].daysMask = from.entries[i].daysMask;
+    to.entries[i].durationMs = from.entries[i].durationMs;
+    to.entries[i].color = from.entries[i].color;
+    to.entries[i].sunriseMinutes = from.entries[i].sunriseMinutes;
+    to.entries[i].snoozeMinutes = from.entries[i].snoozeMinutes;
+  }
+  to.count = from.count;
+}
+
+void snapshotNetwork(NetworkSettings &to, const NetworkSettings &from) {
+  memcpy(to.ntpServers, from.ntpServers, sizeof(to.ntpServers));
+  to.ntpServerCount = from.ntpServerCount;
+  to.utcOffsetMinutes = from.utcOffsetMinutes;
+  memcpy(to.timezone, from.timezone, sizeof(to.timezone));
+  to.fleetRole = from.fleetRole;
+  memcpy(to.fleetGroup, from.fleetGroup, sizeof(to.fleetGroup));
+  to.fleetPort = from.fleetPort;
+}
+
+void snapshotConfig(ConfigSnapshot &snapshot) {
+  memset(static_cast<void *>(&snapshot), 0, sizeof(snapshot));
+  snapshot.power.powerOn = config.power.powerOn;
+  snapshot.power.exitSpecialMode = config.power.exitSpecialMode;
+  setText(snapshot.power.startupMode, modeToString(config.power.startupMode));
+  setText(snapshot.power.mode, modeToString(config.power.mode));
+  memcpy(static_cast<void *>(&snapshot.time), &config.time, sizeof(snapshot.time));
+  snapshotDisplay(snapshot.display, config.display);
+  memcpy(static_cast<void *>(&snapshot.dots), &config.dots, sizeof(snapshot.dots));
+  snapshotAlarms(snapshot.alarm, config.alarm);
+  snapshotNetwork(snapshot.network, config.network);
+  memcpy(static_cast<void *>(&snapshot.sinric), &config.sinric, sizeof(snapshot.sinric));
+}
+
+void applyConfigSnapshot(const ConfigSnapshot &snapshot) {
+  config.power.powerOn = snapshot.power.powerOn;
+  config.power.exitSpecialMode = snapshot.power.exitSpecialMode;
+  config.power.startupMode = modeFromString(snapshot.power.startupMode);
+  config.power.mode = modeFromString(snapshot.power.mode);
+  memcpy(static_cast<void *>(&config.time), &snapshot.time, sizeof(config.time));
+  memcpy(static_cast<void *>(&config.display), &snapshot.display, sizeof(config.display));
+  config.display.schedule.count = min(config.display.schedule.count, MAX_SCHEDULE_POINTS);
+  memcpy(static_cast<void *>(&config.dots), &snapshot.dots, sizeof(config.dots));
+  memcpy(static_cast<void *>(&config.alarm), &snapshot.alarm, sizeof(config.alarm));
+  config.alarm.count = min(config.alarm.count, MAX_ALARMS);
+  invalidateAlarmIndex();
+  memcpy(static_cast<void *>(&config.network), &snapshot.network, sizeof(config.network));
+  config.network.ntpServerCount = min(config.network.ntpServerCount, MAX_NTP_SERVERS);
+  for (uint8_t i = 0; i < MAX_NTP_SERVERS; ++i) {
+    resetNtpServerState(i);
+  }
+  memcpy(static_cast<void *>(&config.sinric), &snapshot.sinric, sizeof(config.sinric));
+}
+
+// Reads one slot into configRecord; false if it is missing, truncated, from another layout or corrupt.
+bool readConfigSlot(uint8_t slot) {
+  File file = LittleFS.open(CONFIG_SLOT_PATHS[slot], "r");
+  if (!file) {
+    return false;
+  }
+  const bool complete = file.size() == sizeof(ConfigRecord) &&
+                        file.read(reinterpret_cast<uint8_t *>(&configRecord), sizeof(ConfigRecord)) ==
+                            sizeof(ConfigRecord);
+  file.close();
+  return complete && configRecord.magic == CONFIG_RECORD_MAGIC && configRecord.version == CONFIG_RECORD_VERSION &&
+         configRecord.payloadBytes == sizeof(ConfigSnapshot) && configRecord.crc == configRecordCrc(configRecord);
+}
+
+// Applies the newest valid slot; slot 0 is read a second time only when it wins.
+bool loadConfigSlots() {
+  int8_t best = -1;
+  uint32_t bestSequence = 0;
+  for (uint8_t slot = 0; slot < 2; ++slot) {
+    if (readConfigSlot(slot) && (best < 0 || static_cast<int32_t>(configRecord.sequence - bestSequence) > 0)) {
+      best = static_cast<int8_t>(slot);
+      bestSequence = configRecord.sequence;
+    }
+  }
+  if (best < 0 || (best == 0 && !readConfigSlot(0))) {
+    return false;
+  }
+  applyConfigSnapshot(configRecord.payload);
+  configStore.activeSlot = best;
+  configStore.sequence = bestSequence;
+  configStore.storedValid = true;
+  configStore.storedCrc = configPayloadCrc(configRecord);
+  return true;
+}
+
+// Writes the config now if its content differs from the newest slot. The record goes to the other
+// slot, so a power cut mid-write always leaves the previous record intact. Returns false when the
+// write failed; the config then stays dirty and is retried after the next quiet period.
+bool flushConfig() {
+  configRecord.magic = CONFIG_RECORD_MAGIC;
+  configRecord.version = CONFIG_RECORD_VERSION;
+  configRecord.payloadBytes = sizeof(ConfigSnapshot);
+  snapshotConfig(configRecord.payload);
+  const uint32_t contentCrc = configPayloadCrc(configRecord);
+  if (configStore.storedValid && contentCrc == configStore.storedCrc) {
+    configStore.dirty = false;
+    ++configStore.unchanged;
+    return true;
+  }
+  configRecord.sequence = configStore.sequence + 1;
+  configRecord.crc = configRecordCrc(configRecord);
+  const uint8_t slot = configStore.activeSlot == 0 ? 1 : 0;
+  const uint32_t startUs = micros();
+  bool ok = configStore.mounted;
+  if (ok) {
+    File file = LittleFS.open(CONFIG_SLOT_PATHS[slot], "w");
+    ok = file && file.write(reinterpret_cast<const uint8_t *>(&configRecord), sizeof(ConfigRecord)) ==
+                     sizeof(ConfigRecord);
+    if (file) {
+      file.close();
+    }
+  }
+  const uint32_t elapsedUs = micros() - startUs;
+  if (!ok) {
+    ++configStore.failures;
+    configStore.firstChangeMs = configStore.lastChangeMs = millis();  // back off instead of retrying every loop
+#ifdef DEBUG_SERIAL
+    Serial.println(F("[Config] Write failed"));
+#endif  // DEBUG_SERIAL
+    return false;
+  }
+  configStore.storedValid = true;
+  configStore.storedCrc = contentCrc;
+  configStore.activeSlot = static_cast<int8_t>(slot);
+  configStore.sequence = configRecord.sequence;
+  configStore.dirty = false;
+  ++configStore.writes;
+  configStore.bytesWritten += sizeof(ConfigRecord);
+  configStore.lastWriteUs = elapsedUs;
+  configStore.maxWriteUs = max(configStore.maxWriteUs, elapsedUs);
+#ifdef DEBUG_SERIAL
+  Serial.printf("[Config] Saved record %u to slot %u in %u us\n", static_cast<unsigned>(configStore.sequence),
+                slot, static_cast<unsigned>(elapsedUs));
+#endif  // DEBUG_SERIAL
+  return true;
+}
+
+void requestConfigSave() {
+  const unsigned long nowMs = millis();
+  if (!configStore.dirty) {
+    configStore.dirty = true;
+    configStore.firstChangeMs = nowMs;
+  }
+  configStore.lastChangeMs = nowMs;
+  ++configStore.requests;
+}
+
+void serviceConfigSave() {
+  if (!configStore.dirty) {
+    return;
+  }
+  const unsigned long nowMs = millis();
+  if (nowMs - configStore.lastChangeMs >= CONFIG_SAVE_QUIET_MS ||
+      nowMs - configStore.firstChangeMs >= CONFIG_SAVE_MAX_DELAY_MS) {
+    flushConfig();
+  }
+}
+
+// Imports config.json (uploaded with uploadfs or left by an older firmware) on top of the defaults.
+bool importConfigJson() {
+  File file = LittleFS.open(CONFIG_PATH, "r");
+  if (!file) {
+    return false;
+  }
+
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, file);
+  file.close();
+  if (err) {
+    return false;
+  }
+
+  readConfigFields(doc["power"].as<JsonObjectConst>(), "power");
+  config.power.exitSpecialMode = false;
+
+  JsonObject display = doc["display"].as<JsonObject>();
+  if (!display.isNull()) {
+    readConfigFields(display, "display");
+    JsonObject perDigit = display["per_digit_color"].as<JsonObject>();
+    if (!perDigit.isNull()) {
+      readConfigFields(perDigit, "display", "per_digit_color");
+      JsonArray values = perDigit["values"].as<JsonArray>();
+      for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
+        if (!values.isNull() && i < values.size()) {
+          config.display.perDigitColor[i] = hexToColor(values[i].as<String>(), config.display.generalColor);
+        } else {
+          config.display.perDigitColor[i] = config.display.generalColor;
+        }
+      }
+    }
+    JsonObject effect = display["effect"].as<JsonObject>();
+    if (!effect.isNull()) {
+      readEffectJson(effect);
+    }
+    readConfigFields(display["quiet_hours"].as<JsonObjectConst>(), "display", "quiet_hours");
+    JsonObject schedule = display["brightness_schedule"].as<JsonObject>();
+    if (!schedule.isNull()) {
+      readScheduleJson(schedule);
+    }
+  }
+
+  readConfigFields(doc["dots"].as<JsonObjectConst>(), "dots");
+
+  if (!readAlarmListJson(doc["alarms"])) {
+    JsonObject alarm = doc["alarm"].as<JsonObject>();  // configurations with a single alarm
+    if (!alarm.isNull()) {
+      readAlarmJson(alarm, config.alarm.entries[0]);
+    }
+  }
+  invalidateAlarmIndex();
+
+  JsonObject network = doc["network"].as<JsonObject>();
+  if (!network.isNull()) {
+    readConfigFields(network, "network");
+    if (!readNtpServersJson(network["ntp_servers"])) {
+      String ntp = network["ntp_server"].as<String>();
+      if (ntp.length() > 0) {
+        setNtpServers(&ntp, 1);  // configurations written before ntp_servers existed
+      }
+    }
+    if (!network["timezone"].isNull()) {
+      setText(config.network.timezone, network["timezone"].as<String>().c_str());
+    }
+    JsonObject fleetConfig = network["fleet"].as<JsonObject>();
+    if (!fleetConfig.isNull()) {
+      readFleetJson(fleetConfig);
+    }
+  }
+
+  JsonObject sinric = doc["sinric"].as<JsonObject>();
+  if (!sinric.isNull()) {
+    readConfigFields(sinric, "sinric");
+    if (!sinric["app_key"].isNull()) {
+      setText(config.sinric.appKey, sinric["app_key"].as<String>().c_str());
+    }
+    if (!sinric["app_secret"].isNull()) {
+      setText(config.sinric.appSecret, sinric["app_secret"].as<String>().c_str());
+    }
+    if (!sinric["device_id"].isNull()) {
+      setText(config.sinric.deviceId, sinric["device_id"].as<String>().c_str());
+    }
+  }
+
+  return true;
+}
+
+// The binary slots are authoritative; JSON is only read when neither slot holds a valid record,
+// and the result is written to a slot right away.
+bool loadConfig() {
+  const uint32_t startUs = micros();
+  if (!LittleFS.begin()) {
+    LittleFS.format();
+    if (!LittleFS.begin()) {
+      return false;
+    }
+  }
+  configStore.mounted = true;
+
+  if (loadConfigSlots()) {
+    configStore.loadedFrom = CONFIG_SLOT_PATHS[configStore.activeSlot];
+    configStore.loadUs = micros() - startUs;
+    return true;
+  }
+
+  loadDefaultConfig();
+  const bool hasJson = LittleFS.exists(CONFIG_PATH);
+  const bool imported = hasJson && importConfigJson();
+  if (hasJson && !imported) {
+    loadDefaultConfig();  // drop whatever a partial import left behind
+  }
+  configStore.loadedFrom = imported ? CONFIG_PATH : "defaults";
+  configStore.loadUs = micros() - startUs;
+  flushConfig();
+  return imported || !hasJson;
+}
+
+// Optional /layout.json describing a larger face; the compiled layout is kept when it is
+// missing or inconsistent. Must run after LittleFS is mounted and before the output begins.
+bool loadLayout() {
+  if (!LittleFS.exists(LAYOUT_PATH)) {
+    return false;
+  }
+  File file = LittleFS.open(LAYOUT_PATH, "r");
+  if (!file) {
+    return false;
+  }
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, file);
+  file.close();
+  if (err) {
+    return false;
+  }
+
+  DisplayLayout layout = COMPILED_LAYOUT;
+  layout.digitCount = doc["digits"].as<uint8_t>();
+  layout.ledsPerSegment = doc["leds_per_segment"].as<uint8_t>();
+  layout.ledCount = doc["led_count"].as<uint16_t>();
+  JsonArray order = doc["segment_order"].as<JsonArray>();
+  if (!order.isNull()) {
+    if (order.size() != SEGMENTS_PER_DIGIT) {
+      return false;
+    }
+    for (uint8_t position = 0; position < SEGMENTS_PER_DIGIT; ++position) {
+      String name = order[position].as<String>();
+      name.toLowerCase();
+      if (name.length() != 1 || name.charAt(0) < 'a' || name.charAt(0) > 'g') {
+        return false;
+      }
+      layout.segmentSlot[name.charAt(0) - 'a'] = position;
+    }
+  }
+  JsonArray bases = doc["digit_base"].as<JsonArray>();
+  if (bases.isNull() || bases.size() != layout.digitCount) {
+    return false;
+  }
+  for (uint8_t digit = 0; digit < layout.digitCount && digit < MAX_DIGIT_COUNT; ++digit) {
+    layout.digitBase[digit] = bases[digit].as<uint16_t>();
+  }
+  JsonArray dots = doc["dots"].as<JsonArray>();
+  layout.dotCount = dots.isNull() ? 0 : dots.size();
+  for (uint8_t dot = 0; dot < layout.dotCount && dot < MAX_DOT_COUNT; ++dot) {
+    layout.dotIndex[dot] = dots[dot].as<uint16_t>();
+  }
+
+  if (!isLayoutValid(layout)) {
+#ifdef DEBUG_SERIAL
+    Serial.println(F("[Clock] Ignoring invalid /layout.json"));
+#endif
+    return false;
+  }
+  activeLayout = layout;
+  layoutRuns = compileLayout(layout);
+  layoutFromFile = true;
+  return true;
+}
+
+uint32_t timeToSeconds(const TimeSettings &time) {
+  return static_cast<uint32_t>(time.hour) * 3600UL + static_cast<uint32_t>(time.minute) * 60UL + time.second;
+}
+
+TimeSettings secondsToTime(uint32_t seconds) {
+  seconds %= 24UL * 3600UL;
+  TimeSettings result;
+  result.hour = seconds / 3600UL;
+  seconds %= 3600UL;
+  result.minute = seconds / 60UL;
+  result.second = seconds % 60UL;
+  return result;
+}
+
+// millis() extended to 64 bits; read on every display refresh so a wrap is never missed.
+uint64_t monotonicMillis() {
+  const uint32_t now = millis();
+  if (now < millisLast) {
+    ++millisHigh;
+  }
+  millisLast = now;
+  return (static_cast<uint64_t>(millisHigh) << 32) | now;
+}
+
+// micros() wraps every 71 minutes; the display refresh (at most 60 s apart) keeps this current.
+uint64_t monotonicMicros() {
+  const uint32_t now = micros();
+  if (now < microsLast) {
+    ++microsHigh;
+  }
+  microsLast = now;
+  return (static_cast<uint64_t>(microsHigh) << 32) | now;
+}
+
+int32_t appliedSlewMs(uint64_t elapsedMs) {
+  return slewProgressMs(timeBase.slewMs, elapsedMs, TIME_SLEW_RATE_PPM);
+}
+
+uint64_t epochMillisAt(uint64_t localMs) {
+  const uint64_t elapsed = localMs - timeBase.anchorLocalMs;
+  const int64_t driftMs = (static_cast<int64_t>(elapsed) * timeBase.driftPpb) / 1000000000LL;
+  return timeBase.anchorEpochMs + elapsed + driftMs + appliedSlewMs(elapsed);
+}
+
+uint64_t currentEpochMillis() {
+  return epochMillisAt(monotonicMillis());
+}
+
+bool isTimeSlewing() {
+  return appliedSlewMs(monotonicMillis() - timeBase.anchorLocalMs) != timeBase.slewMs;
+}
+
+// POSIX TZ rules ("CET-1CEST,M3.5.0,M10.5.0/3"). Offsets are stored east of UTC, i.e. with the
+// sign flipped from the TZ string. The transitions of one year are computed once and cached.
+struct TzRule {
+  enum Kind : uint8_t { MonthWeekDay, JulianNoLeap, ZeroBasedDay };
+  Kind kind{MonthWeekDay};
+  uint8_t month{0};
+  uint8_t week{0};  // 1-5, 5 = last
+  uint8_t weekday{0};
+  uint16_t day{0};
+  int32_t timeSeconds{2 * 3600};  // local time of the change, 02:00 by default
+};
+
+struct TimeZoneRules {
+  int32_t stdOffsetSeconds{0};
+  int32_t dstOffsetSeconds{0};
+  bool hasDst{false};
+  TzRule start;
+  TzRule end;
+};
+
+struct TzYearCache {
+  int32_t year{INT32_MIN};
+  int64_t startUtc{0};  // DST start and end of that year, in UTC seconds
+  int64_t endUtc{0};
+};
+
+// Local offset and date for the current instant, valid until the next midnight or transition.
+struct CivilDate {
+  bool valid{false};
+  uint64_t fromUtcMs{0};
+  uint64_t untilUtcMs{0};
+  int32_t offsetSeconds{0};
+  bool dst{false};
+  int32_t year{1970};
+  uint8_t month{1};
+  uint8_t day{1};
+  uint8_t weekday{4};  // 0 = Sunday
+};
+
+TimeZoneRules activeTimeZone;
+TzYearCache tzYearCache;
+CivilDate civilDate;
+uint32_t civilDateRefreshes = 0;
+
+int64_t floorDiv(int64_t value, int64_t divisor) {
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's algorithm).
+int64_t daysFromCivil(int32_t year, uint8_t month, uint8_t day) {
+  year -= month <= 2;
+  const int32_t era = (year >= 0 ? year : year - 399) / 400;
+  const uint32_t yearOfEra = static_cast<uint32_t>(year - era * 400);
+  const uint32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+}
+
+void civilFromDays(int64_t days, int32_t &year, uint8_t &month, uint8_t &day) {
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const uint32_t dayOfEra = static_cast<uint32_t>(days - era * 146097);
+  const uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  const uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  const uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+  day = static_cast<uint8_t>(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+  month = static_cast<uint8_t>(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+  year = static_cast<int32_t>(yearOfEra + era * 400 + (month <= 2));
+}
+
+uint8_t weekdayFromDays(int64_t days) {
+  return static_cast<uint8_t>(days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6);
+}
+
+bool isLeapYear(int32_t year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+bool parseTzNumber(const char *&cursor, int32_t minValue, int32_t maxValue, int32_t &value) {
+  if (!isdigit(static_cast<unsigned char>(*cursor))) {
+    return false;
+  }
+  value = 0;
+  while (isdigit(static_cast<unsigned char>(*cursor))) {
+    value = value * 10 + (*cursor++ - '0');
+    if (value > maxValue) {
+      return false;
+    }
+  }
+  return value >= minValue;
+}
+
+bool parseTzName(const char *&cursor) {
+  const char *start = cursor;
+  if (*cursor == '<') {
+    while (*cursor != '\0' && *cursor != '>') {
+      ++cursor;
+    }
+    if (*cursor != '>') {
+      return false;
+    }
+    ++cursor;
+    return cursor - start >= 5;  // "<" + at least 3 characters + ">"
+  }
+  while (isalpha(static_cast<unsigned char>(*cursor))) {
+    ++cursor;
+  }
+  return cursor - start >= 3;
+}
+
+// [+|-]hh[:mm[:ss]], hours up to maxHours.
+bool parseTzTime(const char *&cursor, int32_t maxHours, int32_t &seconds) {
+  int32_t sign = 1;
+  if (*cursor == '+' || *cursor == '-') {
+    sign = *cursor++ == '-' ? -1 : 1;
+  }
+  int32_t hours = 0;
+  int32_t minutes = 0;
+  int32_t secs = 0;
+  if (!parseTzNumber(cursor, 0, maxHours, hours)) {
+    return false;
+  }
+  if (*cursor == ':' && !parseTzNumber(++cursor, 0, 59, minutes)) {
+    return false;
+  }
+  if (*cursor == ':' && !parseTzNumber(++cursor, 0, 59, secs)) {
+    return false;
+  }
+  seconds = sign * (hours * 3600 + minutes * 60 + secs);
+  return true;
+}
+
+bool parseTzRule(const char *&cursor, TzRule &rule) {
+  int32_t value = 0;
+  if (*cursor == 'M') {
+    int32_t week = 0;
+    int32_t weekday = 0;
+    if (!parseTzNumber(++cursor, 1, 12, value) || *cursor != '.' || !parseTzNumber(++cursor, 1, 5, week) ||
+        *cursor != '.' || !parseTzNumber(++cursor, 0, 6, weekday)) {
+      return false;
+    }
+    rule.kind = TzRule::MonthWeekDay;
+    rule.month = value;
+    rule.week = week;
+    rule.weekday = weekday;
+  } else if (*cursor == 'J') {
+    if (!parseTzNumber(++cursor, 1, 365, value)) {
+      return false;
+    }
+    rule.kind = TzRule::JulianNoLeap;
+    rule.day = value;
+  } else {
+    if (!parseTzNumber(cursor, 0, 365, value)) {
+      return false;
+    }
+    rule.kind = TzRule::ZeroBasedDay;
+    rule.day = value;
+  }
+  rule.timeSeconds = 2 * 3600;
+  return *cursor != '/' || parseTzTime(++cursor, 167, rule.timeSeconds);
+}
+
+bool parsePosixTz(const char *text, TimeZoneRules &tz) {
+  const char *cursor = text;
+  int32_t offset = 0;
+  if (!parseTzName(cursor) || !parseTzTime(cursor, 24, offset)) {
+    return false;
+  }
+  tz = TimeZoneRules();
+  tz.stdOffsetSeconds = -offset;
+  if (*cursor == '\0') {
+    return true;
+  }
+  if (!parseTzName(cursor)) {
+    return false;
+  }
+  tz.hasDst = true;
+  tz.dstOffsetSeconds = tz.stdOffsetSeconds + 3600;
+  if (*cursor != ',' && *cursor != '\0') {
+    if (!parseTzTime(cursor, 24, offset)) {
+      return false;
+    }
+    tz.dstOffsetSeconds = -offset;
+  }
+  if (*cursor == '\0') {
+    const char *usRules = "M3.2.0,M11.1.0";  // POSIX leaves the default to the implementation
+    return parseTzRule(usRules, tz.start) && parseTzRule(++usRules, tz.end);
+  }
+  return *cursor == ',' && parseTzRule(++cursor, tz.start) && *cursor == ',' && parseTzRule(++cursor, tz.end) &&
+         *cursor == '\0';
+}
+
+// Local time (seconds since the epoch) at which a rule fires in the given year.
+int64_t tzRuleLocalSeconds(const TzRule &rule, int32_t year) {
+  const int64_t jan1 = daysFromCivil(year, 1, 1);
+  int64_t day = jan1;
+  switch (rule.kind) {
+    case TzRule::JulianNoLeap:
+      day = jan1 + rule.day - 1 + (isLeapYear(year) && rule.day >= 60 ? 1 : 0);
+      break;
+    case TzRule::ZeroBasedDay:
+      day = jan1 + rule.day;
+      break;
+    case TzRule::MonthWeekDay: {
+      const int64_t first = daysFromCivil(year, rule.month, 1);
+      const int64_t next = rule.month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, rule.month + 1, 1);
+      day = first + (rule.weekday + 7 - weekdayFromDays(first)) % 7 + (rule.week - 1) * 7;
+      while (day >= next) {
+        day -= 7;  // week 5 means the last such weekday of the month
+      }
+      break;
+    }
+  }
+  return day * 86400 + rule.timeSeconds;
+}
+
+const TzYearCache &tzTransitionsForYear(int32_t year) {
+  if (tzYearCache.year != year) {
+    tzYearCache.year = year;
+    tzYearCache.startUtc = tzRuleLocalSeconds(activeTimeZone.start, year) - activeTimeZone.stdOffsetSeconds;
+    tzYearCache.endUtc = tzRuleLocalSeconds(activeTimeZone.end, year) - activeTimeZone.dstOffsetSeconds;
+  }
+  return tzYearCache;
+}
+
+// UTC offset in effect at utcSeconds, and the next instant it changes.
+int32_t timeZoneOffsetAt(int64_t utcSeconds, bool &dst, int64_t &nextChangeUtc) {
+  dst = false;
+  nextChangeUtc = INT64_MAX;
+  if (!activeTimeZone.hasDst) {
+    return activeTimeZone.stdOffsetSeconds;
+  }
+  int32_t year;
+  uint8_t month;
+  uint8_t day;
+  civilFromDays(floorDiv(utcSeconds + activeTimeZone.stdOffsetSeconds, 86400), year, month, day);
+  const TzYearCache &transitions = tzTransitionsForYear(year);
+  const int64_t start = transitions.startUtc;
+  const int64_t end = transitions.endUtc;
+  dst = start < end ? (utcSeconds >= start && utcSeconds < end) : (utcSeconds >= start || utcSeconds < end);
+  if (utcSeconds < min(start, end)) {
+    nextChangeUtc = min(start, end);
+  } else if (utcSeconds < max(start, end)) {
+    nextChangeUtc = max(start, end);
+  } else {
+    nextChangeUtc = (static_cast<int64_t>(daysFromCivil(year + 1, 1, 1)) * 86400) -
+                    max(activeTimeZone.stdOffsetSeconds, activeTimeZone.dstOffsetSeconds);  // revisit at new year
+  }
+  return dst ? activeTimeZone.dstOffsetSeconds : activeTimeZone.stdOffsetSeconds;
+}
+
+void refreshCivilDate(uint64_t utcMs) {
+  const int64_t utcSeconds = static_cast<int64_t>(utcMs / 1000);
+  int64_t nextChangeUtc = INT64_MAX;
+  civilDate.offsetSeconds = timeZoneOffsetAt(utcSeconds, civilDate.dst, nextChangeUtc);
+  const int64_t days = floorDiv(utcSeconds + civilDate.offsetSeconds, 86400);
+  civilFromDays(days, civilDate.year, civilDate.month, civilDate.day);
+  civilDate.weekday = weekdayFromDays(days);
+  const int64_t nextMidnightUtc = (days + 1) * 86400 - civilDate.offsetSeconds;
+  civilDate.fromUtcMs = utcMs;
+  civilDate.untilUtcMs = static_cast<uint64_t>(min(nextMidnightUtc, nextChangeUtc)) * 1000;
+  civilDate.valid = true;
+  ++civilDateRefreshes;
+}
+
+// Hot path: a range check, the date and offset are only recomputed at midnight or a transition.
+const CivilDate &civilDateAt(uint64_t utcMs) {
+  if (!civilDate.valid || utcMs < civilDate.fromUtcMs || utcMs >= civilDate.untilUtcMs) {
+    refreshCivilDate(utcMs);
+  }
+  return civilDate;
+}
+
+// Rebuilds the zone from network.timezone, or from the fixed utc_offset_minutes when unset.
+bool applyTimeZoneConfig() {
+  TimeZoneRules rules;
+  bool valid = true;
+  if (config.network.timezone[0] != '\0') {
+    valid = parsePosixTz(config.network.timezone, rules);
+  }
+  if (config.network.timezone[0] == '\0' || !valid) {
+    rules = TimeZoneRules();
+    rules.stdOffsetSeconds = static_cast<int32_t>(config.network.utcOffsetMinutes) * 60;
+  }
+  activeTimeZone = rules;
+  tzYearCache.year = INT32_MIN;
+  civilDate.valid = false;
+  invalidateAlarmIndex();
+  return valid;
+}
+
+// Seeds the time base from a local time of day, before (or without) any NTP sync.
+void setTimeBaseFromLocal(const TimeSettings &time) {
+  const int64_t localSeconds = static_cast<int64_t>(timeToSeconds(time)) + 86400;  // stays positive
+  bool dst = false;
+  int64_t nextChangeUtc = 0;
+  const int32_t offset =
+      timeZoneOffsetAt(localSeconds - activeTimeZone.stdOffsetSeconds, dst, nextChangeUtc);
+  timeBase.anchorLocalMs = monotonicMillis();
+  timeBase.anchorEpochMs = static_cast<uint64_t>(localSeconds - offset) * 1000ULL;
+  civilDate.valid = false;
+  timeBase.slewMs = 0;
+  invalidateAlarmIndex();
+}
+
+// Feeds an NTP sample (server epoch ms at localMs). Small errors are slewed, large ones stepped,
+// and the oscillator drift is re-estimated from the raw interval since the previous sample.
+void disciplineTimeBase(uint64_t ntpEpochMs, uint64_t localMs) {
+  const int64_t error = static_cast<int64_t>(ntpEpochMs - epochMillisAt(localMs));
+  timeBase.lastSyncErrorMs = static_cast<int32_t>(constrain(error, -2147483647LL, 2147483647LL));
+
+  if (timeBase.synced && timeBase.driftReference && localMs - timeBase.lastSyncLocalMs >= DRIFT_MIN_INTERVAL_MS) {
+    const int64_t localElapsed = static_cast<int64_t>(localMs - timeBase.lastSyncLocalMs);
+    const int64_t ntpElapsed = static_cast<int64_t>(ntpEpochMs - timeBase.lastSyncEpochMs);
+    const int64_t measuredPpb = ((ntpElapsed - localElapsed) * 1000000000LL) / localElapsed;
+    if (measuredPpb >= -DRIFT_MAX_PPB && measuredPpb <= DRIFT_MAX_PPB) {
+      timeBase.driftPpb = timeBase.driftSamples == 0
+                              ? static_cast<int32_t>(measuredPpb)
+                              : static_cast<int32_t>((3LL * timeBase.driftPpb + measuredPpb) / 4);
+      if (timeBase.driftSamples < 255) {
+        ++timeBase.driftSamples;
+      }
+    }
+  }
+
+  if (!timeBase.synced || error >= TIME_STEP_THRESHOLD_MS || error <= -TIME_STEP_THRESHOLD_MS) {
+    timeBase.anchorEpochMs = ntpEpochMs;
+    timeBase.slewMs = 0;
+    ++timeBase.steps;
+  } else {
+    timeBase.anchorEpochMs = epochMillisAt(localMs);
+    timeBase.slewMs = static_cast<int32_t>(error);
+    ++timeBase.slews;
+  }
+  timeBase.anchorLocalMs = localMs;
+  timeBase.lastSyncLocalMs = localMs;
+  timeBase.lastSyncEpochMs = ntpEpochMs;
+  timeBase.driftReference = true;
+  timeBase.synced = true;
+  invalidateAlarmIndex();
+}
+
+// Moves the phase of the time base by errorMs without touching the drift estimate or the sync
+// history: slewed when small, stepped otherwise (returns true). Used by LAN phase sync.
+bool alignTimeBasePhase(int64_t errorMs) {
+  const uint64_t localMs = monotonicMillis();
+  const PhaseAlignment alignment = planPhaseAlignment(epochMillisAt(localMs), errorMs, TIME_STEP_THRESHOLD_MS);
+  timeBase.anchorEpochMs = alignment.anchorEpochMs;
+  timeBase.anchorLocalMs = localMs;
+  timeBase.slewMs = alignment.slewMs;
+  if (alignment.step) {
+    civilDate.valid = false;
+    invalidateAlarmIndex();
+  }
+  return alignment.step;
+}
+
+// The time base is checkpointed into RTC user memory, which survives soft resets, watchdog
+// resets and OTA reboots (not power cycles). The RTC timer keeps counting through those
+// resets, so a warm boot adds the RTC-measured downtime to the checkpoint and shows the
+// correct time before WiFi is even up.
+struct RtcCheckpoint {
+  uint32_t magic{RTC_CHECKPOINT_MAGIC};
+  uint32_t rtcTicks{0};      // system_get_rtc_time() when epochMs was taken
+  uint32_t rtcPeriodQ12{0};  // RTC tick length in us, 12 fractional bits
+  uint32_t synced{0};
+  uint64_t epochMs{0};
+  uint64_t lastSyncEpochMs{0};
+  int32_t driftPpb{0};
+  uint32_t driftSamples{0};
+  uint32_t crc{0};
+  uint32_t reserved{0};
+};
+
+static_assert(sizeof(RtcCheckpoint) % 4 == 0, "RTC memory is accessed in 4-byte blocks");
+
+struct BootTimeStats {
+  bool restored{false};
+  bool restoredSynced{false};
+  uint32_t downtimeMs{0};     // reset duration measured by the RTC
+  uint32_t timeValidMs{0};    // millis() when the time became trustworthy, 0 until then
+  uint32_t firstSyncMs{0};
+  int32_t restoreErrorMs{0};  // first NTP correction after a restore
+  uint32_t checkpoints{0};
+  const char *fallback{"cold boot"};
+};
+
+BootTimeStats bootTime;
+unsigned long lastRtcCheckpointMs = 0;
+
+uint32_t crc32(const uint8_t *data, size_t length) {
+  uint32_t crc = 0xFFFFFFFFUL;
+  while (length-- > 0) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+uint32_t rtcCheckpointCrc(const RtcCheckpoint &checkpoint) {
+  return crc32(reinterpret_cast<const uint8_t *>(&checkpoint), offsetof(RtcCheckpoint, crc));
+}
+
+void saveRtcCheckpoint() {
+  RtcCheckpoint checkpoint;
+  checkpoint.rtcPeriodQ12 = system_rtc_clock_cali_proc();
+  checkpoint.rtcTicks = system_get_rtc_time();
+  checkpoint.epochMs = currentEpochMillis();
+  checkpoint.synced = timeBase.synced ? 1 : 0;
+  checkpoint.lastSyncEpochMs = timeBase.lastSyncEpochMs;
+  checkpoint.driftPpb = timeBase.driftPpb;
+  checkpoint.driftSamples = timeBase.driftSamples;
+  checkpoint.crc = rtcCheckpointCrc(checkpoint);
+  ESP.rtcUserMemoryWrite(RTC_CHECKPOINT_OFFSET, reinterpret_cast<uint32_t *>(&checkpoint), sizeof(checkpoint));
+  lastRtcCheckpointMs = millis();
+  ++bootTime.checkpoints;
+}
+
+bool isWarmReset(uint32_t reason) {
+  return reason == REASON_WDT_RST || reason == REASON_EXCEPTION_RST || reason == REASON_SOFT_WDT_RST ||
+         reason == REASON_SOFT_RESTART || reason == REASON_DEEP_SLEEP_AWAKE;
+}
+
+// Rebuilds the time base from the checkpoint; false on a cold boot or an unusable checkpoint.
+bool restoreRtcCheckpoint() {
+  if (!isWarmReset(system_get_rst_info()->reason)) {
+    bootTime.fallback = "cold boot";
+    return false;
+  }
+  RtcCheckpoint checkpoint;
+  if (!ESP.rtcUserMemoryRead(RTC_CHECKPOINT_OFFSET, reinterpret_cast<uint32_t *>(&checkpoint), sizeof(checkpoint)) ||
+      checkpoint.magic != RTC_CHECKPOINT_MAGIC || checkpoint.crc != rtcCheckpointCrc(checkpoint)) {
+    bootTime.fallback = "no checkpoint";
+    return false;
+  }
+  const uint32_t ticks = system_get_rtc_time() - checkpoint.rtcTicks;
+  const uint64_t downtimeMs = ((static_cast<uint64_t>(ticks) * checkpoint.rtcPeriodQ12) >> 12) / 1000ULL;
+  if (downtimeMs > RTC_RESTORE_MAX_AGE_MS) {
+    bootTime.fallback = "stale checkpoint";
+    return false;
+  }
+
+  timeBase.anchorLocalMs = monotonicMillis();
+  timeBase.anchorEpochMs = checkpoint.epochMs + downtimeMs;
+  timeBase.slewMs = 0;
+  timeBase.driftPpb = checkpoint.driftPpb;
+  timeBase.driftSamples = static_cast<uint8_t>(min(checkpoint.driftSamples, static_cast<uint32_t>(255)));
+  timeBase.synced = checkpoint.synced != 0;
+  timeBase.lastSyncEpochMs = checkpoint.lastSyncEpochMs;
+  timeBase.driftReference = false;  // the downtime was timed by the RTC, not the main oscillator
+  civilDate.valid = false;
+  invalidateAlarmIndex();
+
+  bootTime.restored = true;
+  bootTime.restoredSynced = timeBase.synced;
+  bootTime.downtimeMs = static_cast<uint32_t>(downtimeMs);
+  if (timeBase.synced) {
+    bootTime.timeValidMs = max(millis(), 1UL);
+  }
+#ifdef DEBUG_SERIAL
+  Serial.printf("[Clock] Time restored from RTC memory (down %u ms)\n", bootTime.downtimeMs);
+#endif
+  return true;
+}
+
+void recordBootSync() {
+  if (bootTime.firstSyncMs != 0) {
+    return;
+  }
+  bootTime.firstSyncMs = max(millis(), 1UL);
+  if (bootTime.timeValidMs == 0) {
+    bootTime.timeValidMs = bootTime.firstSyncMs;
+  }
+  if (bootTime.restored) {
+    bootTime.restoreErrorMs = timeBase.lastSyncErrorMs;
+  }
+}
+
+uint64_t currentLocalMillis() {
+  const uint64_t utcMs = currentEpochMillis();
+  return static_cast<uint64_t>(static_cast<int64_t>(utcMs) + civilDateAt(utcMs).offsetSeconds * 1000LL);
+}
+
+TimeSettings computeCurrentTime() {
+  return secondsToTime(static_cast<uint32_t>((currentLocalMillis() / 1000) % 86400));
+}
+
+// millis() that elapse while the time base advances by epochDeltaMs, drift and slew included.
+// A running slew caps the result at its end, when the rate changes back.
+uint32_t localMillisForEpochDelta(uint32_t epochDeltaMs) {
+  int64_t ratePpb = timeBase.driftPpb;
+  uint32_t cap = UINT32_MAX;
+  if (isTimeSlewing()) {
+    ratePpb += (timeBase.slewMs > 0 ? 1 : -1) * static_cast<int64_t>(TIME_SLEW_RATE_PPM) * 1000;
+    const uint32_t magnitude = timeBase.slewMs < 0 ? -timeBase.slewMs : timeBase.slewMs;
+    const uint64_t slewEndLocalMs =
+        timeBase.anchorLocalMs + (static_cast<uint64_t>(magnitude) * 1000000ULL) / TIME_SLEW_RATE_PPM;
+    cap = static_cast<uint32_t>(slewEndLocalMs - monotonicMillis()) + 1;
+  }
+  const uint64_t localMs = (static_cast<uint64_t>(epochDeltaMs) * 1000000000ULL) / (1000000000LL + ratePpb);
+  return static_cast<uint32_t>(min<uint64_t>(localMs, cap));
+}
+
+uint16_t minutesFromComponents(uint8_t hour, uint8_t minute) {
+  return static_cast<uint16_t>(hour) * 60 + static_cast<uint16_t>(minute);
+}
+
+bool isInRangeWrap(uint16_t current, uint16_t start, uint16_t end) {
+  if (start == end) {
+    return true;
+  }
+  if (start < end) {
     return current >= start && current < end;
   }
-  return current >= start || current < end;
+  return current >= start || current < end;
+}
+
+bool isQuietHoursActive(const TimeSettings &time) {
+  if (!config.display.quietHours.enabled) {
+    return false;
+  }
+  const uint16_t start = minutesFromComponents(config.display.quietHours.startHour,
+                                               config.display.quietHours.startMinute);
+  const uint16_t end = minutesFromComponents(config.display.quietHours.endHour,
+                                             config.display.quietHours.endMinute);
+  const uint16_t current = minutesFromComponents(time.hour, time.minute);
+  return isInRangeWrap(current, start, end);
+}
+
+// The schedule is evaluated per frame, so it is compiled into one brightness and one colour
+// temperature level per minute of the day: a frame costs two array reads.
+uint8_t scheduleBrightness[MINUTES_PER_DAY];
+uint8_t scheduleColorTemperature[MINUTES_PER_DAY];
+bool scheduleCompiled = false;
+uint16_t schedulePointMinutes[MAX_SCHEDULE_POINTS];  // sorted, as compiled
+uint8_t schedulePointCount = 0;
+
+// A brightness set by hand (web or Sinric) while the schedule runs holds until the next
+// schedule point, then the schedule takes over again.
+struct ScheduleOverride {
+  bool active{false};
+  uint8_t seenBrightness{0};
+  unsigned long untilMs{0};
+};
+
+ScheduleOverride scheduleOverride;
+
+struct ScheduleStats {
+  uint32_t compiles{0};
+  uint32_t lastCompileUs{0};
+};
+
+ScheduleStats scheduleStats;
+
+uint8_t kelvinToLevel(uint16_t kelvin) {
+  return static_cast<uint8_t>((static_cast<uint32_t>(kelvin - COLOR_TEMPERATURE_MIN_K) * 255UL +
+                               (COLOR_TEMPERATURE_NEUTRAL_K - COLOR_TEMPERATURE_MIN_K) / 2) /
+                              (COLOR_TEMPERATURE_NEUTRAL_K - COLOR_TEMPERATURE_MIN_K));
+}
+
+uint16_t levelToKelvin(uint8_t level) {
+  return static_cast<uint16_t>(COLOR_TEMPERATURE_MIN_K +
+                               (static_cast<uint32_t>(level) * (COLOR_TEMPERATURE_NEUTRAL_K - COLOR_TEMPERATURE_MIN_K) +
+                                127) / 255);
+}
+
+uint8_t interpolateLevel(uint8_t from, uint8_t to, uint16_t step, uint16_t span) {
+  const int32_t delta = static_cast<int32_t>(to) - from;
+  return static_cast<uint8_t>(from + (delta * step + (delta < 0 ? -(span / 2) : span / 2)) / span);
+}
+
+// Each point holds or fades to the next one (in time of day, wrapping at midnight). Points
+// sharing a minute keep the last one.
+void compileBrightnessSchedule() {
+  const unsigned long startUs = micros();
+  const DisplaySettings::BrightnessSchedule &schedule = config.display.schedule;
+  scheduleCompiled = schedule.enabled && schedule.count > 0;
+  scheduleOverride.active = false;
+  scheduleOverride.seenBrightness = config.display.brightness;
+  if (!scheduleCompiled) {
+    return;
+  }
+  uint8_t order[MAX_SCHEDULE_POINTS];
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < schedule.count; ++i) {
+    uint8_t position = count;
+    while (position > 0 && schedule.points[order[position - 1]].minute > schedule.points[i].minute) {
+      --position;
+    }
+    if (position > 0 && schedule.points[order[position - 1]].minute == schedule.points[i].minute) {
+      order[position - 1] = i;
+      continue;
+    }
+    for (uint8_t j = count; j > position; --j) {
+      order[j] = order[j - 1];
+    }
+    order[position] = i;
+    ++count;
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    schedulePointMinutes[i] = schedule.points[order[i]].minute;
+  }
+  schedulePointCount = count;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    const DisplaySettings::SchedulePoint &from = schedule.points[order[i]];
+    const DisplaySettings::SchedulePoint &to = schedule.points[order[(i + 1) % count]];
+    const uint16_t span =
+        count == 1 ? MINUTES_PER_DAY : (to.minute + MINUTES_PER_DAY - from.minute) % MINUTES_PER_DAY;
+    const uint8_t fromLevel = kelvinToLevel(from.kelvin);
+    const uint8_t toLevel = kelvinToLevel(to.kelvin);
+    for (uint16_t step = 0; step < span; ++step) {
+      const uint16_t minute = (from.minute + step) % MINUTES_PER_DAY;
+      if (from.fade) {
+        scheduleBrightness[minute] = interpolateLevel(from.brightness, to.brightness, step, span);
+        scheduleColorTemperature[minute] = interpolateLevel(fromLevel, toLevel, step, span);
+      } else {
+        scheduleBrightness[minute] = from.brightness;
+        scheduleColorTemperature[minute] = fromLevel;
+      }
+    }
+  }
+  ++scheduleStats.compiles;
+  scheduleStats.lastCompileUs = micros() - startUs;
+}
+
+// Milliseconds until the first schedule point strictly after the current minute.
+uint32_t msUntilNextSchedulePoint(uint16_t minute) {
+  uint16_t waitMinutes = MINUTES_PER_DAY;
+  for (uint8_t i = 0; i < schedulePointCount; ++i) {
+    const uint16_t delta = (schedulePointMinutes[i] + MINUTES_PER_DAY - minute) % MINUTES_PER_DAY;
+    if (delta > 0 && delta < waitMinutes) {
+      waitMinutes = delta;
+    }
+  }
+  return localMillisForEpochDelta(static_cast<uint32_t>(waitMinutes) * 60000UL -
+                                  static_cast<uint32_t>(currentLocalMillis() % 60000ULL));
+}
+
+void applyDisplaySettingsWithTime(const TimeSettings &time) {
+  if (scheduleCompiled) {
+    const uint16_t minute = minutesFromComponents(time.hour, time.minute);
+    if (config.display.brightness != scheduleOverride.seenBrightness) {
+      scheduleOverride.seenBrightness = config.display.brightness;
+      scheduleOverride.active = true;
+      scheduleOverride.untilMs = millis() + msUntilNextSchedulePoint(minute);
+    } else if (scheduleOverride.active && static_cast<long>(millis() - scheduleOverride.untilMs) >= 0) {
+      scheduleOverride.active = false;
+    }
+    currentAppliedBrightness =
+        scheduleOverride.active ? config.display.brightness : scheduleBrightness[minute];
+    currentColorTemperature = scheduleColorTemperature[minute];
+    return;
+  }
+  currentColorTemperature = 255;
+  uint8_t desired = constrain(config.display.brightness, static_cast<uint8_t>(1), static_cast<uint8_t>(255));
+  if (config.display.quietHours.enabled && isQuietHoursActive(time)) {
+    desired =
+        constrain(config.display.quietHours.dimBrightness, static_cast<uint8_t>(0), static_cast<uint8_t>(255));
+  }
+  currentAppliedBrightness = desired;
+}
+
+// Next instant (epoch ms) at or after notBeforeMs the alarm fires, 0 if never. Local days are
+// walked from the date of notBeforeMs; before the first sync the weekday is unknown and every
+// day matches.
+uint64_t nextAlarmFireUtcMs(const AlarmEntry &alarm, uint64_t notBeforeMs) {
+  if (!alarm.enabled || (alarm.daysMask & 0x7F) == 0) {
+    return 0;
+  }
+  bool dst = false;
+  int64_t nextChangeUtc = 0;
+  const int64_t notBeforeSeconds = static_cast<int64_t>(notBeforeMs / 1000);
+  int64_t day = floorDiv(notBeforeSeconds + timeZoneOffsetAt(notBeforeSeconds, dst, nextChangeUtc), 86400);
+  const int64_t alarmSeconds = static_cast<int64_t>(alarm.hour) * 3600 + static_cast<int64_t>(alarm.minute) * 60;
+  for (uint8_t i = 0; i < 9; ++i, ++day) {
+    if (timeBase.synced && !(alarm.daysMask & (1 << weekdayFromDays(day)))) {
+      continue;
+    }
+    const int64_t localSeconds = day * 86400 + alarmSeconds;
+    const int64_t utcSeconds =
+        localSeconds - timeZoneOffsetAt(localSeconds - activeTimeZone.stdOffsetSeconds, dst, nextChangeUtc);
+    if (utcSeconds >= 0 && static_cast<uint64_t>(utcSeconds) * 1000ULL >= notBeforeMs) {
+      return static_cast<uint64_t>(utcSeconds) * 1000ULL;
+    }
+  }
+  return 0;
+}
+
+void removeFromAlarmIndex(uint8_t index) {
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < alarmState.orderCount; ++i) {
+    if (alarmState.order[i] != index) {
+      alarmState.order[kept++] = alarmState.order[i];
+    }
+  }
+  alarmState.orderCount = kept;
+}
+
+void insertIntoAlarmIndex(uint8_t index) {
+  const uint64_t fireMs = alarmState.fireUtcMs[index];
+  if (fireMs == 0) {
+    return;
+  }
+  uint8_t position = alarmState.orderCount;
+  while (position > 0 && alarmState.fireUtcMs[alarmState.order[position - 1]] > fireMs) {
+    alarmState.order[position] = alarmState.order[position - 1];
+    --position;
+  }
+  alarmState.order[position] = index;
+  ++alarmState.orderCount;
+}
+
+// An alarm whose minute is still running is kept (so it fires late rather than never), unless
+// it already fired for that minute. Pending snoozes survive the rebuild.
+void rebuildAlarmIndex() {
+  const uint64_t nowMs = currentEpochMillis();
+  const uint64_t earliestMs = nowMs > 59999 ? nowMs - 59999 : 0;
+  alarmState.orderCount = 0;
+  for (uint8_t i = 0; i < config.alarm.count; ++i) {
+    if (alarmState.snoozed[i] && alarmState.fireUtcMs[i] >= earliestMs) {
+      insertIntoAlarmIndex(i);
+      continue;
+    }
+    alarmState.snoozed[i] = false;
+    const uint64_t notBeforeMs = max(earliestMs, alarmState.lastFiredUtcMs[i] + 1);
+    alarmState.fireUtcMs[i] = nextAlarmFireUtcMs(config.alarm.entries[i], notBeforeMs);
+    insertIntoAlarmIndex(i);
+  }
+  alarmState.indexValid = true;
+  ++alarmState.rebuilds;
+}
+
+void startAlarmOverlay(uint8_t source, const Color &color, uint32_t durationMs) {
+  alarmState.active = true;
+  alarmState.ringing = source;
+  alarmState.startMs = millis();
+  alarmState.color = color;
+  alarmState.durationMs = durationMs;
+}
+
+void startAlarm(uint8_t index) {
+  startAlarmOverlay(index, config.alarm.entries[index].color, config.alarm.entries[index].durationMs);
+  ++alarmState.fired;
+#ifdef DEBUG_SERIAL
+  Serial.printf("[Alarm] Alarm %u triggered\n", index);
+#endif
+}
+
+void stopAlarm() {
+  if (!alarmState.active) {
+    return;
+  }
+  alarmState.active = false;
+  alarmState.startMs = 0;
+#ifdef DEBUG_SERIAL
+  Serial.println(F("[Alarm] Cleared"));
+#endif
+  applyDisplaySettings();
+}
+
+// Re-queues the ringing alarm snoozeMinutes from now and silences it.
+bool snoozeAlarm() {
+  if (!alarmState.active || alarmState.ringing == ALARM_SOURCE_TIMER) {
+    return false;
+  }
+  const uint8_t index = alarmState.ringing;
+  removeFromAlarmIndex(index);
+  alarmState.fireUtcMs[index] =
+      currentEpochMillis() + static_cast<uint64_t>(config.alarm.entries[index].snoozeMinutes) * 60000ULL;
+  alarmState.snoozed[index] = true;
+  insertIntoAlarmIndex(index);
+  ++alarmState.snoozes;
+  stopAlarm();
+  return true;
+}
+
+// Per frame only the head of the index is compared with the clock. Alarms that came due while
+// another one was ringing are rescheduled without firing once their minute has passed.
+void updateAlarmState() {
+  if (alarmState.active) {
+    if (millis() - alarmState.startMs >= alarmState.durationMs) {
+      stopAlarm();
+    }
+    return;
+  }
+  if (!alarmState.indexValid) {
+    rebuildAlarmIndex();
+  }
+
+  const uint64_t nowMs = currentEpochMillis();
+  while (alarmState.orderCount > 0) {
+    const uint8_t index = alarmState.order[0];
+    const uint64_t fireMs = alarmState.fireUtcMs[index];
+    if (nowMs < fireMs) {
+      break;
+    }
+    removeFromAlarmIndex(index);
+    alarmState.lastFiredUtcMs[index] = fireMs;
+    alarmState.snoozed[index] = false;
+    alarmState.fireUtcMs[index] = nextAlarmFireUtcMs(config.alarm.entries[index], fireMs + 1);
+    insertIntoAlarmIndex(index);
+    if (nowMs - fireMs < 60000ULL && !alarmState.active) {
+      startAlarm(index);
+    }
+  }
+}
+
+// Brightness floor (0-255) while the next alarm's sunrise ramp runs, 0 outside of it.
+uint8_t alarmSunriseLevel() {
+  if (alarmState.active || alarmState.orderCount == 0) {
+    return 0;
+  }
+  const uint8_t index = alarmState.order[0];
+  const uint32_t rampMs = static_cast<uint32_t>(config.alarm.entries[index].sunriseMinutes) * 60000UL;
+  const uint64_t nowMs = currentEpochMillis();
+  const uint64_t fireMs = alarmState.fireUtcMs[index];
+  if (rampMs == 0 || alarmState.snoozed[index] || nowMs >= fireMs || fireMs - nowMs >= rampMs) {
+    return 0;
+  }
+  const uint32_t elapsedMs = rampMs - static_cast<uint32_t>(fireMs - nowMs);
+  return static_cast<uint8_t>(max(1UL, (static_cast<unsigned long>(elapsedMs) * 255UL) / rampMs));
+}
+
+// Time until the head alarm fires, or until its ramp starts or takes its next brightness step.
+uint32_t msUntilNextAlarmEvent() {
+  if (alarmState.orderCount == 0) {
+    return UINT32_MAX;
+  }
+  const uint8_t index = alarmState.order[0];
+  const uint64_t nowMs = currentEpochMillis();
+  const uint64_t fireMs = alarmState.fireUtcMs[index];
+  if (nowMs >= fireMs) {
+    return 0;
+  }
+  const uint64_t untilFireMs = fireMs - nowMs;
+  uint64_t waitMs = untilFireMs;
+  const uint32_t rampMs = static_cast<uint32_t>(config.alarm.entries[index].sunriseMinutes) * 60000UL;
+  if (rampMs > 0 && !alarmState.snoozed[index]) {
+    waitMs = untilFireMs > rampMs ? untilFireMs - rampMs : min<uint64_t>(untilFireMs, rampMs / 255);
+  }
+  return localMillisForEpochDelta(static_cast<uint32_t>(min<uint64_t>(waitMs, UINT32_MAX)));
+}
+
+uint64_t timerElapsedUs() {
+  uint64_t elapsedUs = timer.accumulatedUs + (timer.running ? monotonicMicros() - timer.startUs : 0);
+  if (timer.kind == TimerKind::Countdown) {
+    elapsedUs = min<uint64_t>(elapsedUs, static_cast<uint64_t>(timer.durationMs) * 1000ULL);
+  }
+  return elapsedUs;
+}
+
+// Time shown by the timer: remaining for a countdown, elapsed for a stopwatch.
+uint64_t timerValueUs() {
+  const uint64_t elapsedUs = timerElapsedUs();
+  return timer.kind == TimerKind::Countdown ? static_cast<uint64_t>(timer.durationMs) * 1000ULL - elapsedUs
+                                            : elapsedUs;
+}
+
+enum class TimerFormat : uint8_t { Centiseconds, Seconds, Minutes };
+
+// Digits of the timer face and when they next change. Four digits show SS.cc under a minute,
+// then MM:SS, then HH:MM; six digits show MM:SS.cc, then HH:MM:SS. A countdown rounds up so
+// it reaches 00.00 exactly when it expires, a stopwatch rounds down.
+struct TimerFace {
+  TimerFormat format{TimerFormat::Centiseconds};
+  uint32_t units{0};  // value in ticks of the last digit
+  uint32_t tickUs{10000};
+  uint32_t untilChangeUs{UINT32_MAX};
+  uint8_t fields[3]{};  // two digits each, most significant first; four-digit faces use the last two
+};
+
+TimerFace computeTimerFace(uint64_t valueUs, bool roundUp) {
+  const bool sixDigits = activeLayout.digitCount >= 6;
+  TimerFace face;
+  uint64_t units = 0;
+  const uint32_t ticks[] = {10000UL, 1000000UL, 60000000UL};
+  const uint64_t limits[] = {sixDigits ? 600000ULL : 6000ULL, sixDigits ? 360000ULL : 6000ULL, 6000ULL};
+  const uint8_t formats = sixDigits ? 2 : 3;
+  bool full = false;
+  for (uint8_t format = 0; format < formats; ++format) {
+    face.format = static_cast<TimerFormat>(format);
+    face.tickUs = ticks[format];
+    units = roundUp ? (valueUs + face.tickUs - 1) / face.tickUs : valueUs / face.tickUs;
+    full = units >= limits[format];
+    if (!full) {
+      break;
+    }
+  }
+  if (full) {
+    units = limits[formats - 1] - 1;  // past 99:59:59 the face stays full
+  }
+  face.units = static_cast<uint32_t>(units);
+  switch (face.format) {
+    case TimerFormat::Centiseconds:
+      face.fields[0] = units / 6000;
+      face.fields[1] = (units / 100) % 60;
+      face.fields[2] = units % 100;
+      break;
+    case TimerFormat::Seconds:
+      face.fields[0] = units / 3600;
+      face.fields[1] = sixDigits ? (units / 60) % 60 : units / 60;
+      face.fields[2] = units % 60;
+      break;
+    case TimerFormat::Minutes:
+      face.fields[1] = units / 60;
+      face.fields[2] = units % 60;
+      break;
+  }
+  if (full) {
+    face.untilChangeUs = UINT32_MAX;
+  } else if (roundUp) {
+    face.untilChangeUs = units == 0 ? UINT32_MAX : static_cast<uint32_t>(valueUs - (units - 1) * face.tickUs);
+  } else {
+    face.untilChangeUs = static_cast<uint32_t>((units + 1) * face.tickUs - valueUs);
+  }
+  return face;
+}
+
+TimerFace currentTimerFace() {
+  return computeTimerFace(timerValueUs(), timer.kind == TimerKind::Countdown);
+}
+
+void startTimer() {
+  if (timer.running) {
+    return;
+  }
+  if (timer.kind == TimerKind::Countdown && timerElapsedUs() >= static_cast<uint64_t>(timer.durationMs) * 1000ULL) {
+    timer.accumulatedUs = 0;  // restarting an expired countdown
+  }
+  timer.startUs = monotonicMicros();
+  timer.running = true;
+  timer.expired = false;
+}
+
+void pauseTimer() {
+  if (!timer.running) {
+    return;
+  }
+  timer.accumulatedUs = timerElapsedUs();
+  timer.running = false;
+}
+
+void resetTimer() {
+  timer.running = false;
+  timer.expired = false;
+  timer.accumulatedUs = 0;
+  timer.lapCount = 0;
+  if (alarmState.active && alarmState.ringing == ALARM_SOURCE_TIMER) {
+    stopAlarm();
+  }
+}
+
+void recordTimerLap() {
+  if (timer.lapCount == MAX_TIMER_LAPS) {
+    memmove(timer.lapMs, timer.lapMs + 1, sizeof(timer.lapMs) - sizeof(timer.lapMs[0]));
+    --timer.lapCount;
+  }
+  timer.lapMs[timer.lapCount++] = static_cast<uint32_t>(timerElapsedUs() / 1000);
+  ++timer.laps;
+}
+
+// A countdown that reached zero stops and raises the alarm overlay, unless an alarm already rings.
+void updateTimerState() {
+  monotonicMicros();  // runs on every refresh so a micros() wrap is never missed
+  if (!timer.running || timer.kind != TimerKind::Countdown ||
+      timerElapsedUs() < static_cast<uint64_t>(timer.durationMs) * 1000ULL) {
+    return;
+  }
+  timer.accumulatedUs = static_cast<uint64_t>(timer.durationMs) * 1000ULL;
+  timer.running = false;
+  timer.expired = true;
+  ++timer.expiries;
+  if (!alarmState.active) {
+    startAlarmOverlay(ALARM_SOURCE_TIMER, Color(255, 255, 255), TIMER_EXPIRY_MS);
+  }
+#ifdef DEBUG_SERIAL
+  Serial.println(F("[Timer] Countdown expired"));
+#endif
 }
 
-bool isQuietHoursActive(const TimeSettings &time) {
-  if (!config.display.quietHours.enabled) {
+// Next digit change while the timer is on screen; only the expiry matters in other modes.
+uint32_t msUntilNextTimerEvent(OperatingMode mode) {
+  if (!timer.running) {
+    return UINT32_MAX;
+  }
+  uint64_t waitUs;
+  if (mode == OperatingMode::Timer) {
+    waitUs = currentTimerFace().untilChangeUs;
+  } else if (timer.kind == TimerKind::Countdown) {
+    waitUs = static_cast<uint64_t>(timer.durationMs) * 1000ULL - timerElapsedUs();
+  } else {
+    return UINT32_MAX;
+  }
+  return static_cast<uint32_t>(min<uint64_t>((waitUs + 999) / 1000, UINT32_MAX));
+}
+
+// Digits beyond HH:MM (seconds) reuse the colours of the minute digits.
+uint8_t digitColorSlot(uint8_t digitIndex) {
+  return digitIndex < DIGIT_COUNT ? digitIndex : DIGIT_COUNT - 2 + (digitIndex % 2);
+}
+
+Color resolveDigitColor(uint8_t index) {
+  if (config.display.perDigitEnabled) {
+    return config.display.perDigitColor[digitColorSlot(index)];
+  }
+  return config.display.generalColor;
+}
+
+// Layers are drawn independently in RAM and composited bottom to top. A layer only
+// covers the LEDs it draws; uncovered LEDs let the layers below show through.
+enum LayerId : uint8_t { LAYER_BASE, LAYER_DOTS, LAYER_MESSAGE, LAYER_OVERLAY, LAYER_COUNT };
+
+constexpr uint32_t LAYER_STAMP_NONE = 0xFFFFFFFFUL;
+
+struct Layer {
+  Color pixels[MAX_LED_COUNT];
+  uint8_t coverage[(MAX_LED_COUNT + 7) / 8];
+  uint8_t opacity{255};
+  uint32_t stamp{LAYER_STAMP_NONE};  // state the layer was last drawn for
+  bool dirty{true};
+};
+
+Layer layers[LAYER_COUNT];
+Color frameBuffer[MAX_LED_COUNT];
+uint8_t composedBrightness = 0;
+uint8_t composedColorTemperature = 255;
+bool frameComposed = false;
+
+void invalidateLayers() {
+  for (Layer &layer : layers) {
+    layer.stamp = LAYER_STAMP_NONE;
+  }
+}
+
+void setLayerOpacity(LayerId id, uint8_t opacity) {
+  if (layers[id].opacity != opacity) {
+    layers[id].opacity = opacity;
+    layers[id].dirty = true;
+  }
+}
+
+// Returns true when the layer must be redrawn for the given state.
+bool beginLayer(LayerId id, uint32_t stamp) {
+  Layer &layer = layers[id];
+  if (layer.stamp == stamp) {
     return false;
   }
-  const uint16_t start = minutesFromComponents(config.display.quietHours.startHour,
-                                               config.display.quietHours.startMinute);
-  const uint16_t end = minutesFromComponents(config.display.quietHours.endHour,
-                                             config.display.quietHours.endMinute);
-  const uint16_t current = minutesFromComponents(time.hour, time.minute);
-  return isInRangeWrap(current, start, end);
+  layer.stamp = stamp;
+  memset(layer.coverage, 0, sizeof(layer.coverage));
+  layer.dirty = true;
+  return true;
+}
+
+void setLayerPixel(Layer &layer, uint16_t ledIndex, const Color &color) {
+  layer.pixels[ledIndex] = color;
+  layer.coverage[ledIndex >> 3] |= 1 << (ledIndex & 7);
+}
+
+void fillRun(Layer &layer, uint16_t start, uint16_t length, const Color &color) {
+  for (uint16_t ledIndex = start; ledIndex < start + length; ++ledIndex) {
+    setLayerPixel(layer, ledIndex, color);
+  }
+}
+
+// Writes every segment run of the digit: lit ones get the colour, the others are cleared.
+void writeSegments(Layer &layer, uint8_t digitIndex, uint8_t segments, const Color &color) {
+  const Color off;
+  const SegmentRun *runs = layoutRuns.segment[digitIndex];
+  for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+    fillRun(layer, runs[segment].start, runs[segment].length, (segments & (1 << segment)) ? color : off);
+  }
+}
+
+void writeDots(Layer &layer, const Color &left, const Color &right) {
+  for (uint8_t dot = 0; dot < activeLayout.dotCount; ++dot) {
+    setLayerPixel(layer, activeLayout.dotIndex[dot], (dot % 2 == 0) ? left : right);
+  }
+}
+
+bool isBlinkPhaseVisible() {
+  return (millis() / 500UL) % 2 == 0;
+}
+
+// The timer blinks its separator while stopped, and keeps it steady while counting.
+bool areDotsBlinking(OperatingMode mode) {
+  return (mode == OperatingMode::Timer && !timer.running) || (mode == OperatingMode::Alarm);
+}
+
+void renderDots(Layer &layer, OperatingMode mode) {
+  bool showDots = config.dots.enabled && mode != OperatingMode::Off;
+  bool dotsVisible = !areDotsBlinking(mode) || isBlinkPhaseVisible();
+
+  Color left;
+  Color right;
+  if (showDots && dotsVisible) {
+    left = config.dots.forceOverride ? config.dots.forcedColor : config.dots.leftColor;
+    right = config.dots.forceOverride ? config.dots.forcedColor : config.dots.rightColor;
+  }
+  writeDots(layer, left, right);
+}
+
+uint8_t scale8(uint8_t value, uint8_t scale) {
+  return static_cast<uint8_t>((static_cast<uint16_t>(value) * (scale + 1)) >> 8);
+}
+
+// Segments shown by a clock digit (HH:MM[:SS]), with the leading hour zero blanked.
+uint8_t clockDigitSegments(const TimeSettings &time, uint8_t digitIndex) {
+  const uint8_t values[MAX_DIGIT_COUNT] = {
+      static_cast<uint8_t>(time.hour / 10),   static_cast<uint8_t>(time.hour % 10),
+      static_cast<uint8_t>(time.minute / 10), static_cast<uint8_t>(time.minute % 10),
+      static_cast<uint8_t>(time.second / 10), static_cast<uint8_t>(time.second % 10)};
+  if (digitIndex == HOUR_TENS_DIGIT_INDEX && values[digitIndex] == 0) {
+    return 0;
+  }
+  return DIGIT_SEGMENTS[values[digitIndex]];
+}
+
+void renderClockWithColor(Layer &layer, const TimeSettings &time, const Color &color) {
+  for (uint8_t i = 0; i < activeLayout.digitCount; ++i) {
+    writeSegments(layer, i, clockDigitSegments(time, i), color);
+  }
+}
+
+// Crossfade between the previous and the new glyph of a digit: segments in both stay lit,
+// the others fade out/in. Progress is derived from millis(), so dropped frames never
+// stretch a transition.
+struct DigitTransition {
+  uint8_t from{0};
+  uint8_t to{0};
+  unsigned long startMs{0};
+  bool active{false};
+};
+
+struct AnimationStats {
+  uint32_t transitions{0};
+  uint32_t frames{0};
+  uint32_t throttled{0};
+  uint32_t maxLoopGapUs{0};
+  uint32_t loopGapsOverTarget{0};
+};
+
+DigitTransition digitTransitions[MAX_DIGIT_COUNT];
+bool digitTransitionsPrimed = false;
+OperatingMode transitionsMode = OperatingMode::Off;  // face the transition history belongs to
+EffectKind transitionsEffect = EffectKind::None;
+AnimationStats animationStats;
+
+void resetDigitTransitions() {
+  digitTransitionsPrimed = false;
+  for (DigitTransition &transition : digitTransitions) {
+    transition.active = false;
+  }
+}
+
+bool areTransitionsActive() {
+  for (uint8_t i = 0; i < activeLayout.digitCount; ++i) {
+    if (digitTransitions[i].active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Color scaleColor(const Color &color, uint8_t level) {
+  return Color(scale8(color.r, level), scale8(color.g, level), scale8(color.b, level));
+}
+
+void writeTransitionDigit(Layer &layer, uint8_t digitIndex, uint8_t segments, const Color &color) {
+  DigitTransition &transition = digitTransitions[digitIndex];
+  const uint16_t durationMs = config.display.transitionMs;
+  const unsigned long nowMs = millis();
+  if (!digitTransitionsPrimed || durationMs == 0) {
+    transition.to = segments;
+    transition.active = false;
+  } else if (segments != transition.to) {
+    transition.from = transition.to;
+    transition.to = segments;
+    transition.startMs = nowMs;
+    if (!transition.active) {
+      ++animationStats.transitions;
+    }
+    transition.active = true;
+  }
+
+  const unsigned long elapsedMs = nowMs - transition.startMs;
+  if (!transition.active || elapsedMs >= durationMs) {
+    transition.active = false;
+    writeSegments(layer, digitIndex, segments, color);
+    return;
+  }
+
+  const uint8_t fadeIn = (elapsedMs * 255UL) / durationMs;
+  const Color rising = scaleColor(color, fadeIn);
+  const Color falling = scaleColor(color, 255 - fadeIn);
+  const Color off;
+  const SegmentRun *runs = layoutRuns.segment[digitIndex];
+  for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+    const bool wasLit = transition.from & (1 << segment);
+    const bool isLit = transition.to & (1 << segment);
+    const Color &target = (wasLit && isLit) ? color : (isLit ? rising : (wasLit ? falling : off));
+    fillRun(layer, runs[segment].start, runs[segment].length, target);
+  }
+}
+
+void renderClock(Layer &layer, const TimeSettings &now) {
+  for (uint8_t i = 0; i < activeLayout.digitCount; ++i) {
+    writeTransitionDigit(layer, i, clockDigitSegments(now, i), resolveDigitColor(i));
+  }
+  digitTransitionsPrimed = true;
+}
+
+// Timer digits switch instantly: a crossfade would blur centiseconds and delay the tick.
+void renderTimer(Layer &layer, const TimerFace &face) {
+  const uint8_t firstField = activeLayout.digitCount >= 6 ? 0 : 1;
+  for (uint8_t i = 0; i < activeLayout.digitCount; ++i) {
+    const uint8_t field = face.fields[firstField + i / 2];
+    const uint8_t value = (i % 2 == 0) ? field / 10 : field % 10;
+    writeSegments(layer, i, DIGIT_SEGMENTS[value], resolveDigitColor(i));
+  }
+}
+
+// Delay between a timer tick and the render that shows it.
+void recordTimerTick(const TimerFace &face, uint64_t valueUs, bool roundUp) {
+  if (face.units == timer.lastShownUnits) {
+    return;
+  }
+  const bool first = timer.lastShownUnits == UINT32_MAX;
+  timer.lastShownUnits = face.units;
+  if (first || !timer.running) {
+    return;
+  }
+  const uint64_t boundaryUs = static_cast<uint64_t>(face.units) * face.tickUs;
+  const uint32_t latencyUs = static_cast<uint32_t>(roundUp ? boundaryUs - valueUs : valueUs - boundaryUs);
+  ++timer.ticks;
+  timer.lastTickLatencyUs = latencyUs;
+  timer.maxTickLatencyUs = max(timer.maxTickLatencyUs, latencyUs);
+}
+
+void renderSolidColor(Layer &layer, const Color &color) {
+  fillRun(layer, 0, activeLayout.ledCount, color);
+}
+
+uint8_t blendChannel(uint8_t under, uint8_t over, uint8_t opacity) {
+  return static_cast<uint8_t>(under + ((static_cast<int16_t>(over) - under) * opacity) / 255);
+}
+
+// Effects engine: integer-only colour generators evaluated per segment run (or per LED for
+// full-strip fills). Positions are 0..255 from the left edge of the display.
+struct EffectStats {
+  uint32_t frames{0};
+  uint32_t totalUs{0};
+  uint32_t lastUs{0};
+  uint32_t maxUs{0};
+};
+
+EffectStats effectStats[EFFECT_COUNT];
+
+uint8_t sin8(uint8_t theta) {
+  return pgm_read_byte(&SINE_TABLE[theta]);
+}
+
+Color hsvToColor(uint8_t hue, uint8_t saturation, uint8_t value) {
+  const uint16_t scaledHue = static_cast<uint16_t>(hue) * 6;
+  const uint8_t region = scaledHue >> 8;
+  const uint8_t remainder = scaledHue & 0xFF;
+  const uint8_t p = scale8(value, 255 - saturation);
+  const uint8_t q = scale8(value, 255 - scale8(saturation, remainder));
+  const uint8_t t = scale8(value, 255 - scale8(saturation, 255 - remainder));
+  switch (region) {
+    case 0:
+      return Color(value, t, p);
+    case 1:
+      return Color(q, value, p);
+    case 2:
+      return Color(p, value, t);
+    case 3:
+      return Color(p, q, value);
+    case 4:
+      return Color(t, p, value);
+    default:
+      return Color(value, p, q);
+  }
+}
+
+Color lerpColor(const Color &from, const Color &to, uint8_t amount) {
+  return Color(blendChannel(from.r, to.r, amount), blendChannel(from.g, to.g, amount),
+               blendChannel(from.b, to.b, amount));
+}
+
+// Keyframe animations streamed from LittleFS (little-endian):
+//   header  "7CLA", version (1), flags (bit 0 = loop), fps, reserved, led_count u16,
+//           frame_count u16, reserved u32
+//   record  type u8 (1 = keyframe, 2 = delta), count u16, then count * RGB for a keyframe
+//           or count * (index u16, RGB) for a delta against the previous frame.
+// The player decodes one record per frame through a fixed window and never holds the clip.
+constexpr uint8_t ANIMATION_MAGIC[4] = {'7', 'C', 'L', 'A'};
+constexpr uint8_t ANIMATION_VERSION = 1;
+constexpr size_t ANIMATION_HEADER_BYTES = 16;
+constexpr uint8_t ANIMATION_FLAG_LOOP = 0x01;
+constexpr uint8_t ANIMATION_RECORD_KEYFRAME = 1;
+constexpr uint8_t ANIMATION_RECORD_DELTA = 2;
+
+struct AnimationHeader {
+  uint8_t flags{0};
+  uint8_t fps{0};
+  uint16_t ledCount{0};
+  uint16_t frameCount{0};
+};
+
+struct AnimationPlayer {
+  File file;
+  bool open{false};
+  bool finished{false};
+  AnimationHeader header;
+  uint16_t frameIndex{0};
+  unsigned long nextFrameMs{0};
+  uint8_t buffer[ANIMATION_BUFFER_BYTES];
+  uint32_t framesDecoded{0};
+  uint32_t framesLate{0};
+  uint32_t decodeErrors{0};
+  uint32_t lastDecodeUs{0};
+  uint32_t maxDecodeUs{0};
+  uint32_t minFreeHeap{0};
+  unsigned long fpsWindowStartMs{0};
+  uint16_t fpsWindowFrames{0};
+  uint16_t measuredFps{0};
+};
+
+AnimationPlayer animationPlayer;
+Color animationFrame[MAX_LED_COUNT];
+
+uint16_t readLe16(const uint8_t *bytes) {
+  return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+bool parseAnimationHeader(const uint8_t *bytes, AnimationHeader &header) {
+  if (memcmp(bytes, ANIMATION_MAGIC, sizeof(ANIMATION_MAGIC)) != 0 || bytes[4] != ANIMATION_VERSION) {
+    return false;
+  }
+  header.flags = bytes[5];
+  header.fps = bytes[6];
+  header.ledCount = readLe16(bytes + 8);
+  header.frameCount = readLe16(bytes + 10);
+  return header.fps > 0 && header.fps <= ANIMATION_MAX_FPS && header.ledCount > 0 &&
+         header.ledCount <= MAX_LED_COUNT && header.frameCount > 0;
+}
+
+void closeAnimation() {
+  if (animationPlayer.open) {
+    animationPlayer.file.close();
+  }
+  animationPlayer.open = false;
+}
+
+bool openAnimation() {
+  closeAnimation();
+  if (!LittleFS.exists(ANIMATION_PATH)) {
+    return false;
+  }
+  File file = LittleFS.open(ANIMATION_PATH, "r");
+  if (!file) {
+    return false;
+  }
+  uint8_t bytes[ANIMATION_HEADER_BYTES];
+  AnimationHeader header;
+  if (file.read(bytes, sizeof(bytes)) != sizeof(bytes) || !parseAnimationHeader(bytes, header)) {
+#ifdef DEBUG_SERIAL
+    Serial.println(F("[Animation] Invalid file header"));
+#endif  // DEBUG_SERIAL
+    file.close();
+    return false;
+  }
+  animationPlayer.file = file;
+  animationPlayer.open = true;
+  animationPlayer.finished = false;
+  animationPlayer.header = header;
+  animationPlayer.frameIndex = 0;
+  animationPlayer.nextFrameMs = millis();
+  animationPlayer.minFreeHeap = ESP.getFreeHeap();
+  animationPlayer.fpsWindowStartMs = animationPlayer.nextFrameMs;
+  animationPlayer.fpsWindowFrames = 0;
+  for (Color &pixel : animationFrame) {
+    pixel = Color();
+  }
+  return true;
+}
+
+uint32_t animationIntervalMs() {
+  return animationPlayer.open ? 1000UL / animationPlayer.header.fps : EFFECT_FRAME_MS;
+}
+
+// Bytes per entry of a record type, 0 for an unknown type.
+uint8_t animationEntryBytes(uint8_t type) {
+  return type == ANIMATION_RECORD_KEYFRAME ? 3 : (type == ANIMATION_RECORD_DELTA ? 5 : 0);
+}
+
+// Walks the record headers of a clip positioned after its header: every one of the
+// frame_count records must have a known type and end inside the file.
+bool validateAnimationRecords(File &file, const AnimationHeader &header) {
+  const size_t fileBytes = file.size();
+  size_t position = ANIMATION_HEADER_BYTES;
+  for (uint16_t frame = 0; frame < header.frameCount; ++frame) {
+    uint8_t record[3];
+    if (!file.seek(position) || file.read(record, sizeof(record)) != sizeof(record)) {
+      return false;
+    }
+    const uint8_t type = record[0];
+    const uint16_t count = readLe16(record + 1);
+    const uint8_t entryBytes = animationEntryBytes(type);
+    if (entryBytes == 0 || (type == ANIMATION_RECORD_KEYFRAME && count > header.ledCount)) {
+      return false;
+    }
+    position += sizeof(record) + static_cast<size_t>(count) * entryBytes;
+    if (position > fileBytes) {
+      return false;
+    }
+    if ((frame & 0xFF) == 0xFF) {
+      yield();  // long clips: keep the watchdog and WiFi fed
+    }
+  }
+  return true;
+}
+
+// Applies one record to animationFrame, streaming its payload through the player buffer.
+bool decodeAnimationRecord() {
+  AnimationPlayer &player = animationPlayer;
+  uint8_t record[3];
+  if (player.file.read(record, sizeof(record)) != sizeof(record)) {
+    return false;
+  }
+  const uint8_t type = record[0];
+  const uint16_t count = readLe16(record + 1);
+  const uint8_t entryBytes = animationEntryBytes(type);
+  if (entryBytes == 0 || (type == ANIMATION_RECORD_KEYFRAME && count > player.header.ledCount)) {
+    return false;
+  }
+  const size_t window = (ANIMATION_BUFFER_BYTES / entryBytes) * entryBytes;
+  size_t remaining = static_cast<size_t>(count) * entryBytes;
+  uint16_t ledIndex = 0;
+  while (remaining > 0) {
+    const size_t chunk = min(remaining, window);
+    if (player.file.read(player.buffer, chunk) != chunk) {
+      return false;
+    }
+    remaining -= chunk;
+    for (const uint8_t *entry = player.buffer; entry < player.buffer + chunk; entry += entryBytes) {
+      const uint8_t *rgb = entry;
+      if (type == ANIMATION_RECORD_DELTA) {
+        ledIndex = readLe16(entry);
+        rgb = entry + 2;
+      }
+      if (ledIndex < MAX_LED_COUNT) {
+        animationFrame[ledIndex] = Color(rgb[0], rgb[1], rgb[2]);
+      }
+      ++ledIndex;
+    }
+  }
+  return true;
+}
+
+// Decodes the next frame when it is due; returns true when animationFrame changed.
+bool advanceAnimation() {
+  AnimationPlayer &player = animationPlayer;
+  const unsigned long nowMs = millis();
+  if (!player.open || player.finished || static_cast<long>(nowMs - player.nextFrameMs) < 0) {
+    return false;
+  }
+  const unsigned long startUs = micros();
+  if (player.frameIndex >= player.header.frameCount) {
+    if ((player.header.flags & ANIMATION_FLAG_LOOP) == 0) {
+      player.finished = true;  // hold the last frame
+      return false;
+    }
+    player.file.seek(ANIMATION_HEADER_BYTES);
+    player.frameIndex = 0;
+  }
+  if (!decodeAnimationRecord()) {
+    ++player.decodeErrors;
+    closeAnimation();
+    return false;
+  }
+  ++player.frameIndex;
+  ++player.framesDecoded;
+
+  // Late frames are decoded anyway (deltas depend on them) but the schedule restarts from now.
+  const uint32_t intervalMs = animationIntervalMs();
+  player.nextFrameMs += intervalMs;
+  if (static_cast<long>(nowMs - player.nextFrameMs) >= 0) {
+    ++player.framesLate;
+    player.nextFrameMs = nowMs + intervalMs;
+  }
+  player.lastDecodeUs = micros() - startUs;
+  player.maxDecodeUs = max(player.maxDecodeUs, player.lastDecodeUs);
+  player.minFreeHeap = min(player.minFreeHeap, ESP.getFreeHeap());
+  ++player.fpsWindowFrames;
+  if (nowMs - player.fpsWindowStartMs >= 1000) {
+    player.measuredFps = (static_cast<uint32_t>(player.fpsWindowFrames) * 1000) / (nowMs - player.fpsWindowStartMs);
+    player.fpsWindowStartMs = nowMs;
+    player.fpsWindowFrames = 0;
+  }
+  return true;
+}
+
+void renderAnimation(Layer &layer) {
+  const uint16_t ledCount = activeLayout.ledCount;
+  for (uint16_t ledIndex = 0; ledIndex < ledCount; ++ledIndex) {
+    setLayerPixel(layer, ledIndex, animationFrame[ledIndex]);
+  }
+}
+
+bool isEffectAnimated(EffectKind effect) {
+  if (effect == EffectKind::Animation) {
+    return animationPlayer.open && !animationPlayer.finished;
+  }
+  return effect == EffectKind::Rainbow || effect == EffectKind::Breathing;
+}
+
+// Animation phase, one full cycle every 256 * 1024 / speed ms (~4 s at the default speed).
+uint8_t effectPhase() {
+  return static_cast<uint8_t>((millis() * config.display.effect.speed) >> 10);
+}
+
+Color effectColor(uint8_t position, uint8_t phase) {
+  const DisplaySettings::EffectSettings &effect = config.display.effect;
+  switch (effect.kind) {
+    case EffectKind::Gradient:
+      return lerpColor(config.display.generalColor, effect.secondaryColor, position);
+    case EffectKind::Rainbow:
+      return hsvToColor(static_cast<uint8_t>(position + phase), 255, 255);
+    case EffectKind::Breathing: {
+      const uint8_t level = 16 + scale8(sin8(phase), 239);
+      const Color &base = config.display.generalColor;
+      return Color(scale8(base.r, level), scale8(base.g, level), scale8(base.b, level));
+    }
+    case EffectKind::Animation:
+    case EffectKind::None:
+    case EffectKind::Count:
+      break;
+  }
+  return config.display.generalColor;
+}
+
+// Horizontal column of each segment inside a digit (F/E left, A/G/D middle, B/C right).
+constexpr uint8_t SEGMENT_COLUMN[SEGMENTS_PER_DIGIT] = {1, 2, 2, 1, 0, 0, 1};
+
+void renderEffectClock(Layer &layer, const TimeSettings &time, uint8_t phase) {
+  const uint16_t columns = activeLayout.digitCount * 3;
+  const Color off;
+  for (uint8_t digit = 0; digit < activeLayout.digitCount; ++digit) {
+    const uint8_t segments = clockDigitSegments(time, digit);
+    const SegmentRun *runs = layoutRuns.segment[digit];
+    for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+      const uint8_t position = ((digit * 3 + SEGMENT_COLUMN[segment]) * 255) / (columns - 1);
+      fillRun(layer, runs[segment].start, runs[segment].length,
+              (segments & (1 << segment)) ? effectColor(position, phase) : off);
+    }
+  }
+}
+
+void renderEffectFill(Layer &layer, uint8_t phase) {
+  const uint16_t ledCount = activeLayout.ledCount;
+  for (uint16_t ledIndex = 0; ledIndex < ledCount; ++ledIndex) {
+    const uint8_t position = ledCount > 1 ? (static_cast<uint32_t>(ledIndex) * 255) / (ledCount - 1) : 0;
+    setLayerPixel(layer, ledIndex, effectColor(position, phase));
+  }
+}
+
+void renderCustomMode(Layer &layer, const TimeSettings &time) {
+  const EffectKind effect = config.display.effect.kind;
+  if (effect == EffectKind::Animation && !animationPlayer.open) {
+    renderSolidColor(layer, config.display.generalColor);  // no valid clip uploaded
+    return;
+  }
+  if (effect != EffectKind::None) {
+    const unsigned long startUs = micros();
+    const uint8_t phase = effectPhase();
+    if (effect == EffectKind::Animation) {
+      renderAnimation(layer);
+    } else if (config.display.perDigitEnabled) {
+      renderEffectClock(layer, time, phase);
+    } else {
+      renderEffectFill(layer, phase);
+    }
+    EffectStats &stats = effectStats[static_cast<uint8_t>(effect)];
+    stats.lastUs = micros() - startUs;
+    stats.totalUs += stats.lastUs;
+    stats.maxUs = max(stats.maxUs, stats.lastUs);
+    ++stats.frames;
+    return;
+  }
+  if (config.display.perDigitEnabled) {
+    renderClock(layer, time);
+  } else {
+    renderSolidColor(layer, config.display.generalColor);
+  }
+}
+
+// Interval between two visible clock digit changes.
+uint32_t clockChangePeriodMs() {
+  return activeLayout.digitCount > DIGIT_COUNT ? 1000UL : 60000UL;
+}
+
+// Changes whenever a visible clock digit changes (seconds only matter on HH:MM:SS faces).
+uint32_t clockStamp(const TimeSettings &now) {
+  return activeLayout.digitCount > DIGIT_COUNT ? timeToSeconds(now)
+                                                : minutesFromComponents(now.hour, now.minute);
+}
+
+bool isEffectRunning(OperatingMode mode) {
+  return mode == OperatingMode::Custom && isEffectAnimated(config.display.effect.kind);
+}
+
+bool isDisplayAnimating(OperatingMode mode) {
+  return !alarmState.active && (isEffectRunning(mode) || areTransitionsActive());
+}
+
+void renderBaseLayer(OperatingMode mode, const TimeSettings &now) {
+  if (isDisplayAnimating(mode)) {
+    // Animations redraw every frame; clips only when the player decoded a new one.
+    const bool playingClip = isEffectRunning(mode) && config.display.effect.kind == EffectKind::Animation;
+    if (!playingClip || advanceAnimation()) {
+      layers[LAYER_BASE].stamp = LAYER_STAMP_NONE;
+    }
+  }
+  TimerFace face;
+  uint32_t stamp = (static_cast<uint32_t>(mode) << 17) | clockStamp(now);
+  if (mode == OperatingMode::Timer) {
+    const uint64_t valueUs = timerValueUs();
+    const bool roundUp = timer.kind == TimerKind::Countdown;
+    face = computeTimerFace(valueUs, roundUp);
+    recordTimerTick(face, valueUs, roundUp);
+    stamp = (static_cast<uint32_t>(mode) << 17) | (static_cast<uint32_t>(face.format) << 20) |
+            (face.units & 0x1FFFFUL);
+  }
+  if (!beginLayer(LAYER_BASE, stamp)) {
+    return;
+  }
+  Layer &layer = layers[LAYER_BASE];
+  // A new face starts the clock from a blank history; within a face (custom mode draws the
+  // clock when no effect is selected) the digits keep crossfading.
+  const OperatingMode historyMode = mode == OperatingMode::Alarm ? OperatingMode::Clock : mode;
+  if (historyMode != transitionsMode || config.display.effect.kind != transitionsEffect) {
+    resetDigitTransitions();
+    transitionsMode = historyMode;
+    transitionsEffect = config.display.effect.kind;
+  }
+  switch (mode) {
+    case OperatingMode::Clock:
+    case OperatingMode::Alarm:
+      renderClock(layer, now);
+      break;
+    case OperatingMode::Timer:
+      renderTimer(layer, face);
+      break;
+    case OperatingMode::Weather:
+      renderSolidColor(layer, config.display.generalColor);
+      break;
+    case OperatingMode::Custom:
+      renderCustomMode(layer, now);
+      break;
+    case OperatingMode::Off:
+      renderSolidColor(layer, Color());
+      break;
+  }
+}
+
+void renderDotsLayer(OperatingMode mode) {
+  const bool visible = !areDotsBlinking(mode) || isBlinkPhaseVisible();
+  const uint32_t stamp = (static_cast<uint32_t>(mode) << 1) | (visible ? 1 : 0);
+  if (beginLayer(LAYER_DOTS, stamp)) {
+    renderDots(layers[LAYER_DOTS], mode);
+  }
+}
+
+// Text messages: the string is converted to glyphs once, then a window of digitCount glyphs
+// is shown. Scrolling shifts the window by one glyph per step and only appends the next one.
+constexpr uint8_t MAX_MESSAGE_LENGTH = 64;
+constexpr uint8_t MESSAGE_SCROLL_GAP = 2;  // blank digits between two passes of a marquee
+constexpr uint16_t DEFAULT_MESSAGE_STEP_MS = 300;
+
+struct TextMessage {
+  char text[MAX_MESSAGE_LENGTH + 1]{};
+  uint8_t glyphs[MAX_MESSAGE_LENGTH]{};
+  uint8_t length{0};
+  bool active{false};
+  bool scrolling{false};
+  uint16_t stepMs{DEFAULT_MESSAGE_STEP_MS};
+  uint32_t durationMs{0};  // 0 keeps the message until it is cleared
+  unsigned long startMs{0};
+  unsigned long lastStepMs{0};
+  uint16_t nextGlyph{0};  // index of the glyph entering on the right at the next step
+  uint32_t steps{0};
+  uint8_t window[MAX_DIGIT_COUNT]{};
+  Color color;
+};
+
+TextMessage message;
+
+// Decodes UTF-8 text into glyphs; the degree sign is the only non-ASCII character kept.
+uint8_t textToGlyphs(const char *text, uint8_t *glyphs, uint8_t capacity) {
+  uint8_t count = 0;
+  for (const uint8_t *cursor = reinterpret_cast<const uint8_t *>(text); *cursor != 0 && count < capacity;
+       ++cursor) {
+    if (*cursor < 0x80) {
+      glyphs[count++] = fontSegments(static_cast<char>(*cursor));
+    } else if (*cursor == 0xC2 && (cursor[1] == 0xB0 || cursor[1] == 0xBA)) {
+      glyphs[count++] = fontSegments(static_cast<char>(FONT_DEGREE));
+      ++cursor;
+    } else if ((*cursor & 0xC0) != 0x80) {
+      glyphs[count++] = 0;  // unsupported character, continuation bytes are skipped
+    }
+  }
+  return count;
 }
 
-uint8_t computeWeekdayFromSeconds(uint32_t seconds) {
-  (void)seconds;
-  if (lastNtpSyncMs == 0) {
-    return 7;
-  }
-  time_t now = time(nullptr);
-  if (now <= 0) {
-    return 7;
-  }
-  struct tm timeInfo;
-#if defined(ESP8266)
-  if (gmtime_r(&now, &timeInfo) == nullptr) {
-    return 7;
-  }
-#else
-  struct tm *tmp = gmtime(&now);
-  if (!tmp) {
-    return 7;
-  }
-  timeInfo = *tmp;
-#endif
-  return static_cast<uint8_t>(timeInfo.tm_wday);
+uint8_t messageGlyphAt(uint16_t index) {
+  return index < message.length ? message.glyphs[index] : 0;
 }
 
-void applyDisplaySettingsWithTime(const TimeSettings &time) {
-  uint8_t desired = constrain(config.display.brightness, static_cast<uint8_t>(1), static_cast<uint8_t>(255));
-  if (config.display.quietHours.enabled && isQuietHoursActive(time)) {
-    desired =
-        constrain(config.display.quietHours.dimBrightness, static_cast<uint8_t>(0), static_cast<uint8_t>(255));
-  }
-  if (desired != currentAppliedBrightness) {
-    strip.setBrightness(desired);
-    currentAppliedBrightness = desired;
+void showMessage(const char *text, bool scroll, uint16_t stepMs, uint32_t durationMs, const Color &color) {
+  strncpy(message.text, text, MAX_MESSAGE_LENGTH);
+  message.text[MAX_MESSAGE_LENGTH] = '\0';
+  message.length = textToGlyphs(message.text, message.glyphs, MAX_MESSAGE_LENGTH);
+  message.scrolling = scroll;
+  message.stepMs = stepMs;
+  message.durationMs = durationMs;
+  message.color = color;
+  message.startMs = millis();
+  message.lastStepMs = message.startMs;
+  message.steps = 0;
+  const uint8_t digitCount = activeLayout.digitCount;
+  if (scroll) {
+    memset(message.window, 0, sizeof(message.window));  // enters from the right
+    message.nextGlyph = 0;
+  } else {
+    for (uint8_t i = 0; i < digitCount; ++i) {
+      message.window[i] = messageGlyphAt(i);
+    }
   }
+  message.active = true;
+  layers[LAYER_MESSAGE].stamp = LAYER_STAMP_NONE;
 }
 
-bool isAlarmScheduledToday(uint8_t weekday) {
-  if (weekday > 6) {
-    return true;
-  }
-  return config.alarm.daysMask & (1 << weekday);
+void clearMessage() {
+  message.active = false;
 }
 
-void startAlarm(const TimeSettings &time) {
-  config.alarm.active = true;
-  config.alarm.startMs = millis();
-  config.alarm.lastTriggerHour = time.hour;
-  config.alarm.lastTriggerMinute = time.minute;
-#ifdef DEBUG_SERIAL
-  Serial.println(F("[Alarm] Triggered"));
-#endif
+bool isMessageScrolling() {
+  return message.active && message.scrolling;
 }
 
-void stopAlarm() {
-  if (!config.alarm.active) {
+void advanceMessage() {
+  const unsigned long nowMs = millis();
+  if (message.durationMs > 0 && nowMs - message.startMs >= message.durationMs) {
+    clearMessage();
     return;
   }
-  config.alarm.active = false;
-  config.alarm.startMs = 0;
-#ifdef DEBUG_SERIAL
-  Serial.println(F("[Alarm] Cleared"));
-#endif
-  applyDisplaySettings();
-}
-
-void updateAlarmState(const TimeSettings &time) {
-  if (config.alarm.active) {
-    if (millis() - config.alarm.startMs >= config.alarm.durationMs) {
-      stopAlarm();
-    }
+  if (!message.scrolling) {
     return;
   }
+  const uint8_t digitCount = activeLayout.digitCount;
+  const uint16_t cycle = message.length + MESSAGE_SCROLL_GAP;
+  while (nowMs - message.lastStepMs >= message.stepMs) {
+    message.lastStepMs += message.stepMs;
+    memmove(message.window, message.window + 1, digitCount - 1);
+    message.window[digitCount - 1] = messageGlyphAt(message.nextGlyph);
+    message.nextGlyph = (message.nextGlyph + 1) % cycle;
+    ++message.steps;
+  }
+}
 
-  if (!config.alarm.enabled) {
-    config.alarm.lastTriggerHour = 255;
-    config.alarm.lastTriggerMinute = 255;
+// The message hides the digits and the dots but leaves other LEDs (full-strip modes) visible.
+void renderMessageLayer() {
+  if (message.active) {
+    advanceMessage();
+  }
+  const uint32_t stamp = message.active ? message.steps : LAYER_STAMP_NONE - 1;
+  if (!beginLayer(LAYER_MESSAGE, stamp) || !message.active) {
     return;
   }
-
-  uint8_t weekday = computeWeekdayFromSeconds(timeToSeconds(time));
-  if (time.hour == config.alarm.hour && time.minute == config.alarm.minute &&
-      isAlarmScheduledToday(weekday)) {
-    bool alreadyTriggered = (config.alarm.lastTriggerHour == time.hour &&
-                             config.alarm.lastTriggerMinute == time.minute);
-    if (!alreadyTriggered) {
-      startAlarm(time);
-    }
-  } else {
-    config.alarm.lastTriggerHour = 255;
-    config.alarm.lastTriggerMinute = 255;
+  Layer &layer = layers[LAYER_MESSAGE];
+  for (uint8_t i = 0; i < activeLayout.digitCount; ++i) {
+    writeSegments(layer, i, message.window[i], message.color);
   }
+  writeDots(layer, Color(), Color());
 }
 
-Color resolveDigitColor(uint8_t index) {
-  if (config.display.perDigitEnabled) {
-    return config.display.perDigitColor[index];
+// The alarm overlay covers the whole strip: the time in the ringing alarm's colour, blinking on
+// a black background.
+void renderAlarmOverlay(const TimeSettings &now) {
+  const bool active = alarmState.active;
+  const bool visible = isBlinkPhaseVisible();
+  // Fades in over the current face instead of cutting to it.
+  const uint32_t ringingMs = millis() - alarmState.startMs;
+  setLayerOpacity(LAYER_OVERLAY, active && ringingMs < ALARM_FADE_IN_MS
+                                     ? static_cast<uint8_t>(ringingMs * 255 / ALARM_FADE_IN_MS)
+                                     : 255);
+  const uint32_t stamp =
+      active ? ((static_cast<uint32_t>(alarmState.ringing) << 19) | (1UL << 18) | (visible ? (1UL << 17) : 0) |
+                clockStamp(now))
+             : 0;
+  if (!beginLayer(LAYER_OVERLAY, stamp) || !active) {
+    return;
+  }
+  Layer &layer = layers[LAYER_OVERLAY];
+  renderSolidColor(layer, Color());
+  if (visible) {
+    const Color color = alarmState.color;
+    renderClockWithColor(layer, now, color);
+    writeDots(layer, color, color);
   }
-  return config.display.generalColor;
 }
 
-void writeDigit(uint8_t digitIndex, uint8_t number, const Color &color,
-                bool suppressLeadingZero = false) {
-  const uint8_t baseIndex = (digitIndex < 2)
-                                ? digitIndex * SEGMENTS_PER_DIGIT
-                                : (digitIndex == 2 ? 16 : 23);
-  uint8_t segments = (number < 10) ? DIGIT_SEGMENTS[number] : 0;
-  if (suppressLeadingZero && number == 0) {
-    segments = 0;
+// Recomposites the frame buffer only when a layer changed since the last composition.
+bool composeLayers() {
+  bool dirty = !frameComposed;
+  for (const Layer &layer : layers) {
+    dirty |= layer.dirty;
+  }
+  if (!dirty) {
+    return false;
   }
 
-  for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
-    uint8_t ledIndex = baseIndex + SEGMENT_LED_OFFSET[segment];
-    if (ledIndex >= LED_COUNT) {
+  const uint16_t ledCount = activeLayout.ledCount;
+  for (uint16_t i = 0; i < ledCount; ++i) {
+    frameBuffer[i] = Color();
+  }
+  for (Layer &layer : layers) {
+    layer.dirty = false;
+    if (layer.opacity == 0) {
       continue;
     }
-    bool enabled = segments & (1 << segment);
-    if (enabled) {
-      strip.setPixelColor(ledIndex, asPixelColor(color));
-    } else {
-      strip.setPixelColor(ledIndex, 0);
+    for (uint16_t block = 0; block < ledCount; block += 8) {
+      uint8_t covered = layer.coverage[block >> 3];
+      while (covered != 0) {
+        const uint16_t ledIndex = block + __builtin_ctz(covered);
+        covered &= covered - 1;
+        Color &out = frameBuffer[ledIndex];
+        const Color &in = layer.pixels[ledIndex];
+        if (layer.opacity == 255) {
+          out = in;
+        } else {
+          out = Color(blendChannel(out.r, in.r, layer.opacity), blendChannel(out.g, in.g, layer.opacity),
+                      blendChannel(out.b, in.b, layer.opacity));
+        }
+      }
     }
   }
+  frameComposed = true;
+  return true;
+}
+
+void invalidateShadowFrame() {
+  shadowFrameValid = false;
+}
+
+size_t frameBytes() {
+  return static_cast<size_t>(activeLayout.ledCount) * 3;
+}
+
+// Output levels in 8.8 fixed point (GRB order), recomputed only when the composed frame or
+// the brightness changes. The fractional byte is what temporal dithering spreads over time.
+uint16_t linearFrame[MAX_FRAME_BYTES];
+bool ditherActive = false;
+uint8_t ditherFrame = 0;
+
+uint16_t toLinearLevel(uint8_t value, uint8_t brightness) {
+  if (brightness == 0) {
+    return 0;  // black, even with dithering
+  }
+  const uint16_t level = config.display.gammaCorrection ? pgm_read_word(&GAMMA_TABLE[value])
+                                                        : static_cast<uint16_t>(value) << 8;
+  return static_cast<uint16_t>((static_cast<uint32_t>(level) * brightness + 127) / 255);
 }
 
-void renderDots(OperatingMode mode) {
-  bool showDots = config.dots.enabled && mode != OperatingMode::Off;
-  bool blink = (mode == OperatingMode::Timer) || (mode == OperatingMode::Alarm);
-  bool dotsVisible = !blink || ((millis() / 500UL) % 2 == 0);
+// Per-channel gains (0-255) of a colour temperature level, from the usual black-body curve fit
+// normalised to 6500 K. Computed with floats, so only when the level changes.
+struct ColorTemperatureGains {
+  uint8_t level{255};
+  uint8_t r{255};
+  uint8_t g{255};
+  uint8_t b{255};
+};
 
-  uint32_t leftColor = 0;
-  uint32_t rightColor = 0;
+ColorTemperatureGains colorTemperatureGains;
 
-  if (showDots && dotsVisible) {
-    Color left = config.dots.forceOverride ? config.dots.forcedColor : config.dots.leftColor;
-    Color right = config.dots.forceOverride ? config.dots.forcedColor : config.dots.rightColor;
-    leftColor = asPixelColor(left);
-    rightColor = asPixelColor(right);
+const ColorTemperatureGains &gainsForColorTemperature(uint8_t level) {
+  if (colorTemperatureGains.level == level) {
+    return colorTemperatureGains;
   }
+  const float t = levelToKelvin(level) / 100.0f;
+  const float red = 255.0f;
+  const float green = 99.4708025861f * logf(t) - 161.1195681661f;
+  const float blue = t <= 19.0f ? 0.0f : 138.5177312231f * logf(t - 10.0f) - 305.0447927307f;
+  const float neutralGreen = 99.4708025861f * logf(65.0f) - 161.1195681661f;
+  const float neutralBlue = 138.5177312231f * logf(55.0f) - 305.0447927307f;
+  colorTemperatureGains.level = level;
+  colorTemperatureGains.r = static_cast<uint8_t>(red);
+  colorTemperatureGains.g = static_cast<uint8_t>(constrain(green * 255.0f / neutralGreen, 0.0f, 255.0f));
+  colorTemperatureGains.b = static_cast<uint8_t>(constrain(blue * 255.0f / neutralBlue, 0.0f, 255.0f));
+  return colorTemperatureGains;
+}
 
-  strip.setPixelColor(DOT_LEFT_INDEX, leftColor);
-  strip.setPixelColor(DOT_RIGHT_INDEX, rightColor);
+uint8_t scaleBrightness(uint8_t brightness, uint8_t gain) {
+  return static_cast<uint8_t>((static_cast<uint16_t>(brightness) * gain + 127) / 255);
 }
 
-void renderClock(const TimeSettings &now) {
-  const uint8_t hourTens = now.hour / 10;
-  const uint8_t hourUnits = now.hour % 10;
-  const uint8_t minuteTens = now.minute / 10;
-  const uint8_t minuteUnits = now.minute % 10;
+// Applies gamma, brightness and the colour temperature to the composed frame.
+void applyColorPipeline(uint8_t brightness, uint8_t colorTemperature) {
+  const ColorTemperatureGains &gains = gainsForColorTemperature(colorTemperature);
+  const uint8_t brightnessR = scaleBrightness(brightness, gains.r);
+  const uint8_t brightnessG = scaleBrightness(brightness, gains.g);
+  const uint8_t brightnessB = scaleBrightness(brightness, gains.b);
+  uint16_t *out = linearFrame;
+  bool fractional = false;
+  for (uint16_t i = 0; i < activeLayout.ledCount; ++i) {
+    *out++ = toLinearLevel(frameBuffer[i].g, brightnessG);
+    *out++ = toLinearLevel(frameBuffer[i].r, brightnessR);
+    *out++ = toLinearLevel(frameBuffer[i].b, brightnessB);
+    for (const uint16_t *channel = out - 3; channel < out; ++channel) {
+      fractional |= (*channel >> 8) < DITHER_MAX_LEVEL && (*channel & 0xE0) != 0;
+    }
+  }
+  ditherActive = config.display.dithering && fractional && ledOutput.supportsDithering();
+}
 
-  uint8_t digits[DIGIT_COUNT] = {hourTens, hourUnits, minuteTens, minuteUnits};
+// Bit-reversed order so successive frames spread the 4 dither thresholds evenly.
+constexpr uint8_t DITHER_ORDER[4] = {0, 2, 1, 3};
 
-  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-    const bool suppressLeadingZero = (i == HOUR_TENS_DIGIT_INDEX);
-    writeDigit(i, digits[i], resolveDigitColor(i), suppressLeadingZero);
+// Quantises linearFrame to 8 bits: rounded, or with an ordered threshold that varies per
+// frame and per LED so sub-step levels average out over the 4-frame cycle.
+void encodeOutputFrame() {
+  const uint16_t bytes = frameBytes();
+  if (!ditherActive) {
+    for (uint16_t i = 0; i < bytes; ++i) {
+      outputFrame[i] = min(255, (linearFrame[i] + 0x80) >> 8);
+    }
+    return;
+  }
+  ++ditherFrame;
+  for (uint16_t i = 0; i < bytes; ++i) {
+    const uint16_t threshold = DITHER_ORDER[(ditherFrame + i / 3) & 3] * 64 + 32;
+    outputFrame[i] = min(255, (linearFrame[i] + threshold) >> 8);
   }
 }
 
-void renderClockWithColor(const TimeSettings &time, const Color &color) {
-  const uint8_t hourTens = time.hour / 10;
-  const uint8_t hourUnits = time.hour % 10;
-  const uint8_t minuteTens = time.minute / 10;
-  const uint8_t minuteUnits = time.minute % 10;
-  uint8_t digits[DIGIT_COUNT] = {hourTens, hourUnits, minuteTens, minuteUnits};
-  for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-    const bool suppressLeadingZero = (i == HOUR_TENS_DIGIT_INDEX);
-    writeDigit(i, digits[i], color, suppressLeadingZero);
+// Pushes the frame only when it differs from the last pushed one.
+void presentFrame() {
+  displaySchedule.framePending = false;
+  if (shadowFrameValid && memcmp(shadowFrame, outputFrame, frameBytes()) == 0) {
+    ++frameStats.skipped;
+    return;
+  }
+  if (!ledOutput.canShow()) {
+    ++frameStats.deferred;  // retried after DISPLAY_RETRY_MS
+    displaySchedule.framePending = true;
+    return;
+  }
+  // The backend may still be reading the shadow copy after show() returns.
+  memcpy(shadowFrame, outputFrame, frameBytes());
+  shadowFrameValid = true;
+
+  const unsigned long startUs = micros();
+  ledOutput.show(shadowFrame, frameBytes());
+  const uint32_t elapsedUs = micros() - startUs;
+  frameStats.lastShowUs = elapsedUs;
+  if (elapsedUs > frameStats.maxShowUs) {
+    frameStats.maxShowUs = elapsedUs;
   }
+  ++frameStats.pushed;
 }
 
-void renderSolidColor(const Color &color) {
-  for (uint16_t i = 0; i < LED_COUNT; ++i) {
-    strip.setPixelColor(i, asPixelColor(color));
+void recordRenderTime(unsigned long startUs) {
+  const uint32_t elapsedUs = micros() - startUs;
+  frameStats.lastRenderUs = elapsedUs;
+  if (elapsedUs > frameStats.maxRenderUs) {
+    frameStats.maxRenderUs = elapsedUs;
+  }
+  if (elapsedUs > FRAME_BUDGET_US) {
+    ++frameStats.overBudget;
   }
 }
 
-void renderCustomMode(const TimeSettings &time) {
-  if (config.display.perDigitEnabled) {
-    renderClock(time);
-  } else {
-    renderSolidColor(config.display.generalColor);
+void scheduleDisplayRefresh();
+
+// Delay between the clock digit change and the render that shows it.
+void recordClockChangeLatency(const TimeSettings &now) {
+  const uint32_t stamp = clockStamp(now);
+  if (stamp == lastRenderedClockStamp) {
+    return;
+  }
+  const bool first = lastRenderedClockStamp == 0xFFFFFFFFUL;
+  lastRenderedClockStamp = stamp;
+  if (first) {
+    return;
+  }
+  const uint32_t latencyMs = static_cast<uint32_t>(currentLocalMillis() % clockChangePeriodMs());
+  ++schedulerStats.clockChanges;
+  schedulerStats.lastChangeLatencyMs = latencyMs;
+  schedulerStats.maxChangeLatencyMs = max(schedulerStats.maxChangeLatencyMs, latencyMs);
+  if (latencyMs > DISPLAY_LATENCY_TARGET_MS) {
+    ++schedulerStats.latencyOverTarget;
   }
 }
 
+// Allocation calls counted by umm_malloc (-DUMM_STATS_FULL), 0 when the build lacks them.
+uint32_t heapAllocationCount() {
+#ifdef UMM_STATS_FULL
+  return umm_get_malloc_count() + umm_get_realloc_count();
+#else
+  return 0;
+#endif
+}
+
 void updateDisplay() {
-  OperatingMode mode = config.power.powerOn ? modeFromString(config.power.mode) : OperatingMode::Off;
+  const uint32_t allocationsBefore = heapAllocationCount();
+  const unsigned long renderStartUs = micros();
+  ++schedulerStats.renders;
+  OperatingMode mode = config.power.powerOn ? config.power.mode : OperatingMode::Off;
   TimeSettings now = computeCurrentTime();
-  updateAlarmState(now);
-  if (config.alarm.active) {
-    if (currentAppliedBrightness != 255) {
-      strip.setBrightness(255);
-      currentAppliedBrightness = 255;
-    }
+  recordClockChangeLatency(now);
+  updateTimerState();
+  updateAlarmState();
+  if (alarmState.active) {
+    currentAppliedBrightness = 255;
   } else {
     applyDisplaySettingsWithTime(now);
+    currentAppliedBrightness = max(currentAppliedBrightness, alarmSunriseLevel());
   }
-  if ((mode == OperatingMode::Off || !config.power.powerOn) && !config.alarm.active) {
-    strip.clear();
-    strip.show();
-    return;
+
+  renderBaseLayer(mode, now);
+  renderDotsLayer(mode);
+  renderMessageLayer();
+  renderAlarmOverlay(now);
+
+  if (composeLayers() || composedBrightness != currentAppliedBrightness ||
+      composedColorTemperature != currentColorTemperature) {
+    composedBrightness = currentAppliedBrightness;
+    composedColorTemperature = currentColorTemperature;
+    applyColorPipeline(composedBrightness, composedColorTemperature);
+    encodeOutputFrame();
+  } else if (ditherActive) {
+    encodeOutputFrame();
   }
 
-  if (config.alarm.active) {
-    bool visible = ((millis() / 500UL) % 2 == 0);
-    if (visible) {
-      strip.clear();
-      renderClockWithColor(now, Color(255, 255, 255));
-      strip.setPixelColor(DOT_LEFT_INDEX, strip.Color(255, 255, 255));
-      strip.setPixelColor(DOT_RIGHT_INDEX, strip.Color(255, 255, 255));
-    } else {
-      strip.clear();
+  recordRenderTime(renderStartUs);
+  presentFrame();
+  scheduleDisplayRefresh();
+  frameStats.minFreeHeap = min(frameStats.minFreeHeap, ESP.getFreeHeap());
+  const uint32_t allocations = heapAllocationCount() - allocationsBefore;
+  if (allocations > 0) {
+    ++frameStats.allocatingFrames;
+    frameStats.lastAllocations = allocations;
+  }
+}
+
+// Time until the next visible change of a static face: clock digit rollover (also the
+// boundary of quiet hours and brightness schedule steps), blink phase, alarm fire, sunrise
+// step or end, timer tick or expiry, message step or expiry.
+uint32_t msUntilNextDisplayEvent(OperatingMode mode) {
+  const uint32_t period = clockChangePeriodMs();
+  uint32_t waitMs = localMillisForEpochDelta(period - static_cast<uint32_t>(currentLocalMillis() % period));
+  const unsigned long nowMs = millis();
+  if (areDotsBlinking(mode) || alarmState.active) {
+    waitMs = min(waitMs, static_cast<uint32_t>(500UL - nowMs % 500UL));
+  }
+  if (alarmState.active) {
+    const uint32_t elapsedMs = nowMs - alarmState.startMs;
+    waitMs = min(waitMs, elapsedMs < alarmState.durationMs ? alarmState.durationMs - elapsedMs : 0);
+    if (elapsedMs < ALARM_FADE_IN_MS) {
+      waitMs = min(waitMs, TRANSITION_FRAME_MS);
     }
   } else {
-    switch (mode) {
-      case OperatingMode::Clock:
-        renderClock(now);
-        break;
-      case OperatingMode::Timer:
-        renderClock(now);
-        break;
-      case OperatingMode::Weather:
-        renderSolidColor(config.display.generalColor);
+    waitMs = min(waitMs, msUntilNextAlarmEvent());
+  }
+  waitMs = min(waitMs, msUntilNextTimerEvent(mode));
+  if (message.active) {
+    if (message.durationMs > 0) {
+      const uint32_t elapsedMs = nowMs - message.startMs;
+      waitMs = min(waitMs, elapsedMs < message.durationMs ? message.durationMs - elapsedMs : 0);
+    }
+    if (message.scrolling) {
+      const uint32_t sinceStepMs = nowMs - message.lastStepMs;
+      waitMs = min(waitMs, sinceStepMs < message.stepMs ? message.stepMs - sinceStepMs : 0);
+    }
+  }
+  return min(waitMs, DISPLAY_MAX_IDLE_MS);
+}
+
+// Animations run at their nominal rate unless a frame costs more than a quarter of the
+// interval; the interval then stretches so rendering never starves the web server.
+uint32_t displayRefreshInterval(OperatingMode mode, bool animated, bool &throttled) {
+  if (!animated) {
+    const uint32_t eventMs = msUntilNextDisplayEvent(mode);
+    return ditherActive ? min(eventMs, DITHER_FRAME_MS) : eventMs;
+  }
+  uint32_t nominalMs = TRANSITION_FRAME_MS;
+  if (isEffectRunning(mode)) {
+    nominalMs = config.display.effect.kind == EffectKind::Animation ? animationIntervalMs() : EFFECT_FRAME_MS;
+  }
+  const uint32_t frameCostMs = (frameStats.lastRenderUs + frameStats.lastShowUs + 999) / 1000;
+  throttled = frameCostMs * 4 > nominalMs;
+  return throttled ? frameCostMs * 4 : nominalMs;
+}
+
+void scheduleDisplayRefresh() {
+  const OperatingMode mode = config.power.powerOn ? config.power.mode : OperatingMode::Off;
+  displaySchedule.animated = isDisplayAnimating(mode);
+  displaySchedule.throttled = false;
+  uint32_t intervalMs = displayRefreshInterval(mode, displaySchedule.animated, displaySchedule.throttled);
+  if (displaySchedule.framePending) {
+    intervalMs = min(intervalMs, DISPLAY_RETRY_MS);
+  }
+  displaySchedule.nextRefreshMs = millis() + intervalMs;
+}
+
+// Redraws every layer, used after a configuration change.
+void refreshDisplay() {
+  invalidateLayers();
+  lastRenderedClockStamp = 0xFFFFFFFFUL;  // a forced render is not a scheduled digit change
+  updateDisplay();
+}
+
+// Web handlers validate and store their changes, then post an Apply command for the side
+// effects; Sinric callbacks post typed commands. loop() applies the queue once per iteration,
+// after the web server and then Sinric have been serviced, so a burst of requests costs one
+// render, one persistence request and one Sinric notification, and within an iteration web
+// changes land before cloud commands, each in arrival order. Work whose result a handler
+// reports (NTP start, fleet socket, Sinric connection) stays in the handler.
+enum class CommandType : uint8_t { Apply, SetPower, SetBrightness, SetColor, Count };
+enum class CommandSource : uint8_t { Web, Cloud };
+
+struct Command {
+  CommandType type{CommandType::Apply};
+  CommandSource source{CommandSource::Web};
+  uint8_t effects{0};  // ApplyEffect bits
+  bool powerOn{false};
+  uint8_t brightness{0};
+  Color color;
+};
+
+// Commands of the same type collapse into one entry, so the queue never holds more than one
+// command per type.
+constexpr uint8_t COMMAND_QUEUE_SIZE = static_cast<uint8_t>(CommandType::Count);
+
+struct CommandQueue {
+  Command entries[COMMAND_QUEUE_SIZE];
+  uint8_t count{0};
+  uint8_t maxDepth{0};
+  uint32_t posted{0};
+  uint32_t collapsed{0};
+  uint32_t applies{0};
+  uint32_t renders{0};
+  uint32_t lastApplyUs{0};
+  uint32_t maxApplyUs{0};
+};
+
+CommandQueue commands;
+
+void postCommand(const Command &command) {
+  ++commands.posted;
+  for (uint8_t i = 0; i < commands.count; ++i) {
+    Command &pending = commands.entries[i];
+    if (pending.type == command.type) {
+      const uint8_t effects = pending.effects | command.effects;
+      pending = command;  // the latest value wins
+      pending.effects = effects;
+      ++commands.collapsed;
+      return;
+    }
+  }
+  commands.entries[commands.count++] = command;
+  commands.maxDepth = max(commands.maxDepth, commands.count);
+}
+
+void requestApply(uint8_t effects) {
+  Command command;
+  command.effects = effects;
+  postCommand(command);
+}
+
+void runApplyEffects(uint8_t effects) {
+  if (effects & APPLY_TIME_ZONE) {
+    applyTimeZoneConfig();
+  }
+  if (effects & APPLY_FLEET) {
+    applyFleetConfig();
+  }
+  if (effects & APPLY_DISPLAY) {
+    applyDisplaySettings();
+  }
+  if (effects & APPLY_REFRESH) {
+    refreshDisplay();
+    ++commands.renders;
+  }
+  if (effects & APPLY_PERSIST) {
+    requestConfigSave();
+  }
+  if (effects & APPLY_SINRIC_SETUP) {
+    setupSinric();
+  } else if (effects & APPLY_SINRIC_STATE) {
+    notifySinricState();
+  }
+}
+
+void applyCommands() {
+  if (commands.count == 0) {
+    return;
+  }
+  const uint32_t startUs = micros();
+  uint8_t effects = 0;
+  for (uint8_t i = 0; i < commands.count; ++i) {
+    const Command &command = commands.entries[i];
+    uint8_t commandEffects = command.effects;
+    switch (command.type) {
+      case CommandType::SetPower:
+        config.power.powerOn = command.powerOn;
+        commandEffects |= APPLY_REFRESH | APPLY_PERSIST | APPLY_SINRIC_STATE;
         break;
-      case OperatingMode::Custom:
-        renderCustomMode(now);
+      case CommandType::SetBrightness:
+        config.display.brightness = command.brightness;
+        commandEffects |= APPLY_DISPLAY | APPLY_REFRESH | APPLY_PERSIST | APPLY_SINRIC_STATE;
         break;
-      case OperatingMode::Alarm:
-        renderClock(now);
+      case CommandType::SetColor:
+        config.display.generalColor = command.color;
+        if (!config.display.perDigitEnabled) {
+          for (uint8_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+            config.display.perDigitColor[digit] = command.color;
+          }
+        }
+        commandEffects |= APPLY_REFRESH | APPLY_PERSIST | APPLY_SINRIC_STATE;
         break;
-      case OperatingMode::Off:
-        strip.clear();
+      case CommandType::Apply:
+      case CommandType::Count:
         break;
     }
-    renderDots(mode);
+    if (command.source == CommandSource::Cloud) {
+      commandEffects &= ~APPLY_SINRIC_STATE;  // Sinric Pro sent this state, no need to echo it
+    }
+    effects |= commandEffects;
   }
-
-  strip.show();
+  commands.count = 0;
+  runApplyEffects(effects);
+  ++commands.applies;
+  commands.lastApplyUs = micros() - startUs;
+  commands.maxApplyUs = max(commands.maxApplyUs, commands.lastApplyUs);
 }
 
 String getRequestBody() {
@@ -757,9 +4203,7 @@ void handleCorsPreflight() {
 void handleGetPower() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["power_on"] = config.power.powerOn;
-  root["mode"] = config.power.mode;
-  root["startup_mode"] = config.power.startupMode;
+  writeConfigFields(root, "power");
   root["exit_special_mode"] = config.power.exitSpecialMode;
   sendJson(doc);
 }
@@ -771,30 +4215,25 @@ void handlePostPower() {
     sendJsonError("Invalid JSON payload");
     return;
   }
-  if (!doc["power_on"].isNull()) {
-    config.power.powerOn = doc["power_on"].as<bool>();
-  }
-  if (!doc["mode"].isNull()) {
-    config.power.mode = sanitizeMode(doc["mode"].as<String>());
-  }
-  if (!doc["startup_mode"].isNull()) {
-    config.power.startupMode = sanitizeMode(doc["startup_mode"].as<String>());
-  }
+  readConfigFields(doc.as<JsonObjectConst>(), "power");
   if (doc["exit_special_mode"].as<bool>()) {
     config.power.mode = config.power.startupMode;
     config.power.exitSpecialMode = false;
   }
-  saveConfig();
-  updateDisplay();
-  notifySinricState();
+  requestApply(APPLY_REFRESH | APPLY_PERSIST | APPLY_SINRIC_STATE);
   handleGetPower();
 }
 
 void handleGetTime() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["ntp_server"] = config.network.ntpServer;
-  root["utc_offset_minutes"] = config.network.utcOffsetMinutes;
+  root["ntp_server"] = config.network.ntpServers[0];
+  JsonArray ntpServers = root["ntp_servers"].to<JsonArray>();
+  for (uint8_t i = 0; i < config.network.ntpServerCount; ++i) {
+    ntpServers.add(config.network.ntpServers[i]);
+  }
+  writeConfigFields(root, "network");
+  root["timezone"] = config.network.timezone;
   TimeSettings now = computeCurrentTime();
   JsonObject current = root["current"].to<JsonObject>();
   current["hour"] = now.hour;
@@ -803,6 +4242,69 @@ void handleGetTime() {
   char buffer[12];
   snprintf(buffer, sizeof(buffer), "%02u:%02u:%02u", now.hour, now.minute, now.second);
   current["formatted"] = buffer;
+  const CivilDate &date = civilDateAt(currentEpochMillis());
+  if (timeBase.synced) {
+    snprintf(buffer, sizeof(buffer), "%04d-%02u-%02u", static_cast<int>(date.year), date.month, date.day);
+    current["date"] = buffer;
+    current["weekday"] = date.weekday;
+  }
+  current["dst"] = date.dst;
+  current["utc_offset_seconds"] = date.offsetSeconds;
+  current["next_change_in_s"] = static_cast<int32_t>((date.untilUtcMs - currentEpochMillis()) / 1000);
+  current["date_refreshes"] = civilDateRefreshes;
+  JsonObject sync = root["sync"].to<JsonObject>();
+  sync["pending"] = ntpClient.state != NtpState::Idle;
+  sync["state"] = ntpStateToString(ntpClient.state);
+  sync["last_result"] = ntpClient.lastResult;
+  sync["last_sync_age_ms"] = lastNtpSyncMs != 0 ? static_cast<int32_t>(millis() - lastNtpSyncMs) : -1;
+  sync["last_rtt_ms"] = ntpClient.lastRttMs;
+  sync["last_offset_ms"] = ntpClient.lastOffsetMs;
+  sync["samples_used"] = ntpClient.lastSamplesUsed;
+  sync["successes"] = ntpClient.successes;
+  sync["failures"] = ntpClient.failures;
+  sync["timeouts"] = ntpClient.timeouts;
+  sync["max_service_us"] = ntpClient.maxServiceUs;
+  JsonArray servers = sync["servers"].to<JsonArray>();
+  for (uint8_t i = 0; i < config.network.ntpServerCount; ++i) {
+    const NtpServerState &server = ntpClient.servers[i];
+    JsonObject entry = servers.add<JsonObject>();
+    entry["host"] = config.network.ntpServers[i];
+    entry["address"] = server.resolved ? server.address.toString() : String();
+    entry["dns_lookups"] = server.lookups;
+    entry["dns_cache_hits"] = server.cacheHits;
+    entry["samples"] = server.samples;
+    entry["failures"] = server.failures;
+    entry["rejected"] = server.rejected;
+    entry["last_rtt_ms"] = server.lastRttMs;
+    entry["min_rtt_ms"] = server.samples > 0 ? server.minRttMs : 0;
+    entry["last_offset_ms"] = server.lastOffsetMs;
+    entry["selected"] = server.selected;
+  }
+  JsonObject base = root["time_base"].to<JsonObject>();
+  base["synced"] = timeBase.synced;
+  base["epoch_ms"] = currentEpochMillis();
+  base["drift_ppm"] = timeBase.driftPpb / 1000.0f;
+  base["drift_samples"] = timeBase.driftSamples;
+  base["last_sync_error_ms"] = timeBase.lastSyncErrorMs;
+  base["slewing"] = isTimeSlewing();
+  base["slew_ms"] = timeBase.slewMs;
+  base["steps"] = timeBase.steps;
+  base["slews"] = timeBase.slews;
+  JsonObject boot = root["boot"].to<JsonObject>();
+  boot["reset_reason"] = ESP.getResetReason();
+  boot["source"] = bootTime.restored ? "rtc" : bootTime.fallback;
+  boot["restored_synced"] = bootTime.restoredSynced;
+  boot["downtime_ms"] = bootTime.downtimeMs;
+  if (bootTime.timeValidMs != 0) {
+    boot["time_valid_after_ms"] = bootTime.timeValidMs;
+  }
+  if (bootTime.firstSyncMs != 0) {
+    boot["first_sync_after_ms"] = bootTime.firstSyncMs;
+    if (bootTime.restored) {
+      boot["restore_error_ms"] = bootTime.restoreErrorMs;
+    }
+  }
+  boot["checkpoints"] = bootTime.checkpoints;
   sendJson(doc);
 }
 
@@ -814,49 +4316,72 @@ void handlePostTime() {
     return;
   }
 
-  bool ntpServerUpdated = false;
+  // The timezone is checked before any field is applied, and the NTP list is all or nothing,
+  // so a 400 leaves the config unchanged.
+  const bool timezoneGiven = !doc["timezone"].isNull();
+  String timezone;
+  if (timezoneGiven) {
+    timezone = doc["timezone"].as<String>();
+    timezone.trim();
+    TimeZoneRules rules;
+    if (timezone.length() >= CONFIG_TIMEZONE_BYTES ||
+        (timezone.length() > 0 && !parsePosixTz(timezone.c_str(), rules))) {
+      sendJsonError("Invalid POSIX TZ string");
+      return;
+    }
+  }
 
-  if (!doc["ntp_server"].isNull()) {
-    String ntp = doc["ntp_server"].as<String>();
-    if (ntp.length() > 0) {
-      config.network.ntpServer = ntp;
-      ntpServerUpdated = true;
+  bool ntpServerUpdated = false;
+  if (!doc["ntp_servers"].isNull()) {
+    if (!readNtpServersJson(doc["ntp_servers"])) {
+      sendJsonError("ntp_servers must list 1 to 4 hostnames");
+      return;
+    }
+    ntpServerUpdated = true;
+  } else if (!doc["ntp_server"].isNull()) {
+    // Replaces the primary server only, the web UI edits a single field.
+    String names[MAX_NTP_SERVERS];
+    names[0] = doc["ntp_server"].as<String>();
+    for (uint8_t i = 1; i < config.network.ntpServerCount; ++i) {
+      names[i] = config.network.ntpServers[i];
+    }
+    if (!setNtpServers(names, max<uint8_t>(config.network.ntpServerCount, 1))) {
+      sendJsonError("ntp_server must be a hostname of 1 to 63 characters");
+      return;
     }
+    ntpServerUpdated = true;
   }
-  if (!doc["utc_offset_minutes"].isNull()) {
-    config.network.utcOffsetMinutes =
-        constrain(doc["utc_offset_minutes"].as<int>(), -720, 840);
+  if (readConfigFields(doc.as<JsonObjectConst>(), "network") & APPLY_TIME_ZONE) {
     ntpServerUpdated = true;  // re-sync to apply offset change
   }
+  if (timezoneGiven) {
+    setText(config.network.timezone, timezone.c_str());
+  }
+  applyTimeZoneConfig();
 
-  timeAnchor = config.time;
-  timeReferenceMs = millis();
+  if (!timeBase.synced) {
+    setTimeBaseFromLocal(config.time);
+    saveRtcCheckpoint();
+  }
   if (ntpServerUpdated && WiFi.status() == WL_CONNECTED) {
-    syncTimeFromNtp();
+    startNtpSync();  // answered below with sync.pending, the reply is applied from loop()
   }
-  applyDisplaySettings();
-  saveConfig();
+  requestApply(APPLY_REFRESH | APPLY_PERSIST);
   handleGetTime();
 }
 
 void handleGetDisplay() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["brightness"] = config.display.brightness;
-  root["general_color"] = colorToHex(config.display.generalColor);
+  writeConfigFields(root, "display");
   JsonObject perDigit = root["per_digit_color"].to<JsonObject>();
-  perDigit["enabled"] = config.display.perDigitEnabled;
+  writeConfigFields(perDigit, "display", "per_digit_color");
   JsonArray values = perDigit["values"].to<JsonArray>();
   for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
     values.add(colorToHex(config.display.perDigitColor[i]));
   }
-  JsonObject quiet = root["quiet_hours"].to<JsonObject>();
-  quiet["enabled"] = config.display.quietHours.enabled;
-  quiet["start_hour"] = config.display.quietHours.startHour;
-  quiet["start_minute"] = config.display.quietHours.startMinute;
-  quiet["end_hour"] = config.display.quietHours.endHour;
-  quiet["end_minute"] = config.display.quietHours.endMinute;
-  quiet["dim_brightness"] = config.display.quietHours.dimBrightness;
+  writeEffectJson(root["effect"].to<JsonObject>());
+  writeConfigFields(root["quiet_hours"].to<JsonObject>(), "display", "quiet_hours");
   sendJson(doc);
 }
 
@@ -868,19 +4393,11 @@ void handlePostDisplay() {
     return;
   }
 
-  if (!doc["brightness"].isNull()) {
-    config.display.brightness = constrain(doc["brightness"].as<int>(), 1, 255);
-  }
-  if (!doc["general_color"].isNull()) {
-    config.display.generalColor = hexToColor(doc["general_color"].as<String>(), config.display.generalColor);
-  }
-
+  readConfigFields(doc.as<JsonObjectConst>(), "display");
   if (!doc["per_digit_color"].isNull()) {
     if (doc["per_digit_color"].is<JsonObject>()) {
       JsonObject perDigit = doc["per_digit_color"].as<JsonObject>();
-      if (!perDigit["enabled"].isNull()) {
-        config.display.perDigitEnabled = perDigit["enabled"].as<bool>();
-      }
+      readConfigFields(perDigit, "display", "per_digit_color");
       if (perDigit["values"].is<JsonArray>()) {
         JsonArray values = perDigit["values"].as<JsonArray>();
         for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
@@ -900,106 +4417,435 @@ void handlePostDisplay() {
     }
   }
 
-  if (!doc["quiet_hours"].isNull()) {
-    JsonObject quiet = doc["quiet_hours"].as<JsonObject>();
-    if (!quiet.isNull()) {
-      if (!quiet["enabled"].isNull()) {
-        config.display.quietHours.enabled = quiet["enabled"].as<bool>();
-      }
-      if (!quiet["start_hour"].isNull()) {
-        config.display.quietHours.startHour = constrain(quiet["start_hour"].as<int>(), 0, 23);
-      }
-      if (!quiet["start_minute"].isNull()) {
-        config.display.quietHours.startMinute = constrain(quiet["start_minute"].as<int>(), 0, 59);
-      }
-      if (!quiet["end_hour"].isNull()) {
-        config.display.quietHours.endHour = constrain(quiet["end_hour"].as<int>(), 0, 23);
-      }
-      if (!quiet["end_minute"].isNull()) {
-        config.display.quietHours.endMinute = constrain(quiet["end_minute"].as<int>(), 0, 59);
+  if (doc["effect"].is<JsonObject>()) {
+    readEffectJson(doc["effect"].as<JsonObject>());
+  } else if (!doc["effect"].isNull()) {
+    config.display.effect.kind = effectFromString(doc["effect"].as<String>());
+  }
+
+  readConfigFields(doc["quiet_hours"].as<JsonObjectConst>(), "display", "quiet_hours");
+
+  requestApply(APPLY_DISPLAY | APPLY_REFRESH | APPLY_PERSIST | APPLY_SINRIC_STATE);
+  handleGetDisplay();
+}
+
+void handleGetSchedule() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  writeScheduleJson(root);
+  root["max_points"] = MAX_SCHEDULE_POINTS;
+  root["active"] = scheduleCompiled;
+  root["manual_override"] = scheduleCompiled && scheduleOverride.active;
+  root["brightness"] = currentAppliedBrightness;
+  root["kelvin"] = levelToKelvin(currentColorTemperature);
+  JsonObject stats = root["stats"].to<JsonObject>();
+  stats["compiles"] = scheduleStats.compiles;
+  stats["last_compile_us"] = scheduleStats.lastCompileUs;
+  sendJson(doc);
+}
+
+void handlePostSchedule() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, getRequestBody());
+  if (err) {
+    sendJsonError("Invalid JSON payload");
+    return;
+  }
+  if (!readScheduleJson(doc.as<JsonObject>())) {
+    sendJsonError(String("points must hold at most ") + MAX_SCHEDULE_POINTS + " entries");
+    return;
+  }
+
+  compileBrightnessSchedule();
+  applyDisplaySettings();  // the reply reports the resulting brightness and temperature
+  requestApply(APPLY_DISPLAY | APPLY_REFRESH | APPLY_PERSIST);
+  handleGetSchedule();
+}
+
+// Streams the compiled curve (one sample every `step` minutes, 1 by default) in small chunks,
+// so the full 1440-minute table never needs a JSON document in RAM.
+void handleGetScheduleCurve() {
+  const uint16_t step = server.hasArg("step") ? constrain(server.arg("step").toInt(), 1, 60) : 1;
+  attachCorsHeaders();
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  char chunk[256];
+  size_t used = snprintf(chunk, sizeof(chunk), "{\"active\":%s,\"step\":%u,\"brightness\":[",
+                         scheduleCompiled ? "true" : "false", step);
+  for (uint8_t series = 0; series < 2; ++series) {
+    for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute += step) {
+      uint16_t value;
+      if (series == 0) {
+        value = scheduleCompiled ? scheduleBrightness[minute] : currentAppliedBrightness;
+      } else {
+        value = levelToKelvin(scheduleCompiled ? scheduleColorTemperature[minute] : 255);
       }
-      if (!quiet["dim_brightness"].isNull()) {
-        config.display.quietHours.dimBrightness =
-            constrain(quiet["dim_brightness"].as<int>(), 0, 255);
+      if (used > sizeof(chunk) - 8) {
+        server.sendContent(chunk, used);
+        used = 0;
       }
+      used += snprintf(chunk + used, sizeof(chunk) - used, minute == 0 ? "%u" : ",%u", value);
     }
+    const char *tail = series == 0 ? "],\"kelvin\":[" : "]}";
+    if (used + strlen(tail) >= sizeof(chunk)) {
+      server.sendContent(chunk, used);
+      used = 0;
+    }
+    used += snprintf(chunk + used, sizeof(chunk) - used, "%s", tail);
   }
+  server.sendContent(chunk, used);
+  server.sendContent("");
+}
 
-  applyDisplaySettings();
-  saveConfig();
-  updateDisplay();
-  notifySinricState();
-  handleGetDisplay();
+const char *timerStateName() {
+  if (timer.running) {
+    return "running";
+  }
+  if (timer.expired) {
+    return "expired";
+  }
+  return timer.accumulatedUs > 0 ? "paused" : "idle";
+}
+
+void handleGetTimer() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["mode"] = timer.kind == TimerKind::Countdown ? "countdown" : "stopwatch";
+  root["state"] = timerStateName();
+  root["duration_ms"] = timer.durationMs;
+  const uint64_t elapsedUs = timerElapsedUs();
+  root["elapsed_ms"] = static_cast<uint32_t>(elapsedUs / 1000);
+  if (timer.kind == TimerKind::Countdown) {
+    root["remaining_ms"] = static_cast<uint32_t>(timerValueUs() / 1000);
+  }
+  const TimerFace face = currentTimerFace();
+  char display[12];
+  if (activeLayout.digitCount >= 6) {
+    snprintf(display, sizeof(display), face.format == TimerFormat::Centiseconds ? "%02u:%02u.%02u" : "%02u:%02u:%02u",
+             face.fields[0], face.fields[1], face.fields[2]);
+  } else {
+    snprintf(display, sizeof(display), face.format == TimerFormat::Centiseconds ? "%02u.%02u" : "%02u:%02u",
+             face.fields[1], face.fields[2]);
+  }
+  root["display"] = display;
+  JsonArray laps = root["laps"].to<JsonArray>();
+  for (uint8_t i = 0; i < timer.lapCount; ++i) {
+    laps.add(timer.lapMs[i]);
+  }
+  JsonObject stats = root["stats"].to<JsonObject>();
+  stats["laps"] = timer.laps;
+  stats["expiries"] = timer.expiries;
+  stats["ticks"] = timer.ticks;
+  stats["last_tick_latency_us"] = timer.lastTickLatencyUs;
+  stats["max_tick_latency_us"] = timer.maxTickLatencyUs;
+  sendJson(doc);
+}
+
+void handlePostTimer() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, getRequestBody());
+  if (err) {
+    sendJsonError("Invalid JSON payload");
+    return;
+  }
+
+  if (!doc["mode"].isNull()) {
+    const String kind = doc["mode"].as<String>();
+    if (kind != "countdown" && kind != "stopwatch") {
+      sendJsonError("mode must be countdown or stopwatch");
+      return;
+    }
+    const TimerKind requested = kind == "countdown" ? TimerKind::Countdown : TimerKind::Stopwatch;
+    if (requested != timer.kind) {
+      resetTimer();
+      timer.kind = requested;
+    }
+  }
+  if (!doc["duration_ms"].isNull()) {
+    timer.durationMs = constrain(doc["duration_ms"].as<uint32_t>(), 1000UL, MAX_TIMER_DURATION_MS);
+    if (timer.kind == TimerKind::Countdown && !timer.running) {
+      resetTimer();
+    }
+  }
+  const String action = doc["action"].isNull() ? String() : doc["action"].as<String>();
+  if (action == "start" || action == "resume") {
+    startTimer();
+  } else if (action == "pause") {
+    pauseTimer();
+  } else if (action == "toggle") {
+    if (timer.running) {
+      pauseTimer();
+    } else {
+      startTimer();
+    }
+  } else if (action == "reset") {
+    resetTimer();
+  } else if (action == "lap") {
+    recordTimerLap();
+  } else if (action.length() > 0) {
+    sendJsonError("Unknown action");
+    return;
+  }
+  uint8_t effects = APPLY_REFRESH;
+  if (doc["show"].as<bool>()) {
+    config.power.mode = OperatingMode::Timer;
+    effects |= APPLY_PERSIST | APPLY_SINRIC_STATE;
+  }
+  requestApply(effects);
+  handleGetTimer();
+}
+
+void handleGetFleet() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["role"] = fleetRoleToString(config.network.fleetRole);
+  root["group"] = config.network.fleetGroup;
+  writeConfigFields(root, "network", "fleet");
+  root["id"] = ESP.getChipId();
+  root["open"] = fleet.open;
+  root["beacon_interval_ms"] = FLEET_BEACON_INTERVAL_MS;
+  root["window_beacons"] = FLEET_WINDOW_BEACONS;
+  root["locked"] = isFleetLocked();
+  if (fleet.leaderId != 0) {
+    JsonObject leader = root["leader"].to<JsonObject>();
+    leader["id"] = fleet.leaderId;
+    leader["ip"] = fleet.leaderIp.toString();
+    leader["synced"] = fleet.leaderSynced;
+    leader["last_beacon_age_ms"] = millis() - fleet.lastBeaconMs;
+  }
+  JsonObject stats = root["stats"].to<JsonObject>();
+  stats["beacons_sent"] = fleet.beaconsSent;
+  stats["beacons_received"] = fleet.beaconsReceived;
+  stats["beacons_ignored"] = fleet.beaconsIgnored;
+  stats["alignments"] = fleet.alignments;
+  stats["steps"] = fleet.steps;
+  stats["last_offset_ms"] = fleet.lastOffsetMs;
+  stats["last_correction_ms"] = fleet.lastCorrectionMs;
+  sendJson(doc);
+}
+
+void handlePostFleet() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, getRequestBody());
+  if (err) {
+    sendJsonError("Invalid JSON payload");
+    return;
+  }
+  if (!readFleetJson(doc.as<JsonObject>())) {
+    sendJsonError("group must be a multicast IPv4 address (224.0.0.0 - 239.255.255.255)");
+    return;
+  }
+  applyFleetConfig();  // the reply reports whether the socket opened
+  requestApply(APPLY_PERSIST);
+  handleGetFleet();
+}
+
+void handleGetDots() {
+  JsonDocument doc;
+  writeConfigFields(doc.to<JsonObject>(), "dots");
+  sendJson(doc);
+}
+
+void handlePostDots() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, getRequestBody());
+  if (err) {
+    sendJsonError("Invalid JSON payload");
+    return;
+  }
+
+  readConfigFields(doc.as<JsonObjectConst>(), "dots");
+
+  requestApply(APPLY_REFRESH | APPLY_PERSIST);
+  handleGetDots();
 }
 
-void handleGetDots() {
+void handleGetMessage() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["enabled"] = config.dots.enabled;
-  root["left_color"] = colorToHex(config.dots.leftColor);
-  root["right_color"] = colorToHex(config.dots.rightColor);
-  root["force_override"] = config.dots.forceOverride;
-  root["forced_color"] = colorToHex(config.dots.forcedColor);
+  root["active"] = message.active;
+  root["text"] = message.active ? message.text : "";
+  root["scroll"] = message.scrolling;
+  root["step_ms"] = message.stepMs;
+  root["duration_ms"] = message.durationMs;
+  root["color"] = colorToHex(message.color);
   sendJson(doc);
 }
 
-void handlePostDots() {
+void handlePostMessage() {
   JsonDocument doc;
   DeserializationError err = deserializeJson(doc, getRequestBody());
   if (err) {
     sendJsonError("Invalid JSON payload");
     return;
   }
-
-  if (!doc["enabled"].isNull()) {
-    config.dots.enabled = doc["enabled"].as<bool>();
-  }
-  if (!doc["left_color"].isNull()) {
-    config.dots.leftColor = hexToColor(doc["left_color"].as<String>(), config.dots.leftColor);
-  }
-  if (!doc["right_color"].isNull()) {
-    config.dots.rightColor = hexToColor(doc["right_color"].as<String>(), config.dots.rightColor);
-  }
-  if (!doc["force_override"].isNull()) {
-    config.dots.forceOverride = doc["force_override"].as<bool>();
-  }
-  if (!doc["forced_color"].isNull()) {
-    config.dots.forcedColor = hexToColor(doc["forced_color"].as<String>(), config.dots.forcedColor);
+  if (doc["clear"].as<bool>()) {
+    clearMessage();
+  } else if (!doc["text"].isNull()) {
+    String text = doc["text"].as<String>();
+    uint8_t glyphs[MAX_MESSAGE_LENGTH];
+    const uint8_t length = textToGlyphs(text.c_str(), glyphs, MAX_MESSAGE_LENGTH);
+    if (length == 0) {
+      clearMessage();
+    } else {
+      // Long messages scroll unless told otherwise.
+      const bool scroll = doc["scroll"].isNull() ? length > activeLayout.digitCount : doc["scroll"].as<bool>();
+      uint16_t stepMs = DEFAULT_MESSAGE_STEP_MS;
+      if (!doc["step_ms"].isNull()) {
+        stepMs = constrain(doc["step_ms"].as<int>(), 50, 2000);
+      }
+      uint32_t durationMs = 0;
+      if (!doc["duration_ms"].isNull()) {
+        durationMs = constrain(doc["duration_ms"].as<uint32_t>(), 0UL, 60UL * 60UL * 1000UL);
+      }
+      const Color color = hexToColor(doc["color"].as<String>(), config.display.generalColor);
+      showMessage(text.c_str(), scroll, stepMs, durationMs, color);
+    }
+  } else {
+    sendJsonError("Missing text");
+    return;
   }
-
-  saveConfig();
-  updateDisplay();
-  handleGetDots();
+  requestApply(APPLY_REFRESH);
+  handleGetMessage();
 }
 
+// JSON export of the running config, in the format config.json is imported from.
 void handleGetConfigFile() {
-  if (!LittleFS.begin()) {
-    sendJsonError("LittleFS unavailable", 500);
+  String content;
+  serializeConfig(content);
+  attachCorsHeaders();
+  server.send(200, "application/json", content);
+}
+
+// Calls visit(field, value) for every leaf of a patch shaped like config.json; false on the
+// first key that is not a scalar field of the table.
+template <typename Visitor>
+bool visitPatchFields(JsonObjectConst root, Visitor visit, String &unknown) {
+  for (JsonPairConst section : root) {
+    JsonObjectConst members = section.value().as<JsonObjectConst>();
+    if (members.isNull()) {
+      unknown = section.key().c_str();
+      return false;
+    }
+    for (JsonPairConst member : members) {
+      JsonObjectConst nested = member.value().as<JsonObjectConst>();
+      if (nested.isNull()) {
+        const FieldDescriptor *field = findConfigField(section.key().c_str(), nullptr, member.key().c_str());
+        if (field == nullptr) {
+          unknown = String(section.key().c_str()) + "." + member.key().c_str();
+          return false;
+        }
+        visit(*field, member.value());
+        continue;
+      }
+      for (JsonPairConst leaf : nested) {
+        const FieldDescriptor *field =
+            findConfigField(section.key().c_str(), member.key().c_str(), leaf.key().c_str());
+        if (field == nullptr) {
+          unknown = String(section.key().c_str()) + "." + member.key().c_str() + "." + leaf.key().c_str();
+          return false;
+        }
+        visit(*field, leaf.value());
+      }
+    }
+  }
+  return true;
+}
+
+// Partial update of single fields without going through a section handler, e.g.
+// {"display": {"brightness": 40}}. The whole patch is validated before anything is applied.
+void handlePatchConfig() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, getRequestBody());
+  if (err || !doc.is<JsonObject>()) {
+    sendJsonError("Invalid JSON payload");
     return;
   }
-  File file = LittleFS.open(CONFIG_PATH, "r");
-  if (!file) {
-    sendJsonError("Config not found", 404);
+  JsonObjectConst root = doc.as<JsonObjectConst>();
+  String problem;
+  const char *invalid = nullptr;
+  const bool known = visitPatchFields(
+      root,
+      [&invalid](const FieldDescriptor &field, JsonVariantConst value) {
+        if (invalid == nullptr && !isValidFieldValue(value, field)) {
+          invalid = field.name;
+        }
+      },
+      problem);
+  if (!known) {
+    sendJsonError("Unknown field: " + problem);
     return;
   }
-  attachCorsHeaders();
-  server.streamFile(file, "application/json");
-  file.close();
+  if (invalid != nullptr) {
+    sendJsonError(String("Invalid value for ") + invalid);
+    return;
+  }
+
+  JsonDocument response;
+  JsonObject updated = response["updated"].to<JsonObject>();
+  uint8_t effects = 0;
+  uint8_t unchanged = 0;
+  visitPatchFields(
+      root,
+      [&](const FieldDescriptor &field, JsonVariantConst value) {
+        if (readConfigField(value, field, true) != FieldUpdate::Changed) {
+          ++unchanged;
+          return;
+        }
+        effects |= field.effects;
+        JsonObject target = updated[field.section];
+        if (target.isNull()) {
+          target = updated[field.section].to<JsonObject>();
+        }
+        if (field.object != nullptr) {
+          JsonObject nested = target[field.object];
+          target = nested.isNull() ? target[field.object].to<JsonObject>() : nested;
+        }
+        writeConfigField(target, field);
+      },
+      problem);
+  response["unchanged"] = unchanged;
+  if (updated.size() > 0) {
+    requestApply(effects | APPLY_PERSIST);
+  }
+  sendJson(response);
 }
 
 void handleGetAlarm() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["enabled"] = config.alarm.enabled;
-  root["hour"] = config.alarm.hour;
-  root["minute"] = config.alarm.minute;
-  root["days_mask"] = config.alarm.daysMask;
-  root["duration_ms"] = config.alarm.durationMs;
-  root["active"] = config.alarm.active;
-  const long remaining = config.alarm.active
-                             ? static_cast<long>(config.alarm.durationMs - (millis() - config.alarm.startMs))
-                             : 0;
+  writeAlarmJson(root, config.alarm.entries[0]);  // alarm 0 at the top level, as before
+  root["active"] = alarmState.active;
+  const bool timerRinging = alarmState.active && alarmState.ringing == ALARM_SOURCE_TIMER;
+  root["ringing"] = alarmState.active && !timerRinging ? static_cast<int>(alarmState.ringing) : -1;
+  root["timer_ringing"] = timerRinging;
+  const long remaining =
+      alarmState.active ? static_cast<long>(alarmState.durationMs - (millis() - alarmState.startMs)) : 0;
   root["remaining_ms"] = remaining > 0 ? remaining : 0;
+  root["max_alarms"] = MAX_ALARMS;
+
+  if (!alarmState.indexValid) {
+    rebuildAlarmIndex();
+  }
+  const uint64_t nowMs = currentEpochMillis();
+  JsonArray alarms = root["alarms"].to<JsonArray>();
+  for (uint8_t i = 0; i < config.alarm.count; ++i) {
+    JsonObject entry = alarms.add<JsonObject>();
+    writeAlarmJson(entry, config.alarm.entries[i]);
+    const uint64_t fireMs = alarmState.fireUtcMs[i];
+    entry["next_in_s"] = fireMs == 0 ? -1 : static_cast<long>(fireMs > nowMs ? (fireMs - nowMs) / 1000 : 0);
+    entry["snoozed"] = alarmState.snoozed[i];
+  }
+  if (alarmState.orderCount > 0) {
+    root["next_alarm"] = alarmState.order[0];
+  } else {
+    root["next_alarm"] = -1;
+  }
+  root["sunrise_level"] = alarmSunriseLevel();
+  JsonObject stats = root["stats"].to<JsonObject>();
+  stats["index_rebuilds"] = alarmState.rebuilds;
+  stats["fired"] = alarmState.fired;
+  stats["snoozes"] = alarmState.snoozes;
   sendJson(doc);
 }
 
@@ -1011,28 +4857,41 @@ void handlePostAlarm() {
     return;
   }
 
-  if (!doc["enabled"].isNull()) {
-    config.alarm.enabled = doc["enabled"].as<bool>();
-  }
-  if (!doc["hour"].isNull()) {
-    config.alarm.hour = constrain(doc["hour"].as<int>(), 0, 23);
-  }
-  if (!doc["minute"].isNull()) {
-    config.alarm.minute = constrain(doc["minute"].as<int>(), 0, 59);
+  bool changed = false;
+  if (!doc["alarms"].isNull()) {
+    if (!readAlarmListJson(doc["alarms"])) {
+      sendJsonError("alarms must be an array of at most 20 entries");
+      return;
+    }
+    for (bool &snoozed : alarmState.snoozed) {
+      snoozed = false;
+    }
+    changed = true;
   }
-  if (!doc["days_mask"].isNull()) {
-    config.alarm.daysMask = doc["days_mask"].as<uint8_t>();
+  JsonObject root = doc.as<JsonObject>();
+  for (const char *key : {"enabled", "hour", "minute", "days_mask", "duration_ms", "color", "sunrise_minutes",
+                          "snooze_minutes"}) {
+    if (!root[key].isNull()) {
+      changed = true;
+    }
   }
-  if (!doc["duration_ms"].isNull()) {
-    uint32_t duration = doc["duration_ms"].as<uint32_t>();
-    config.alarm.durationMs = constrain(duration, 1000UL, 30UL * 60UL * 1000UL);
+  readAlarmJson(root, config.alarm.entries[0]);
+
+  if (doc["snooze"].as<bool>()) {
+    snoozeAlarm();
   }
-  bool requestStop = doc["stop"].as<bool>();
-  if (requestStop || !config.alarm.enabled) {
+  const bool alarmRinging = alarmState.active && alarmState.ringing != ALARM_SOURCE_TIMER;
+  if (doc["stop"].as<bool>() ||
+      (alarmRinging && (alarmState.ringing >= config.alarm.count || !config.alarm.entries[alarmState.ringing].enabled))) {
     stopAlarm();
   }
 
-  saveConfig();
+  uint8_t effects = APPLY_REFRESH;
+  if (changed) {
+    invalidateAlarmIndex();
+    effects |= APPLY_PERSIST;
+  }
+  requestApply(effects);
   handleGetAlarm();
 }
 
@@ -1044,10 +4903,238 @@ void handleInfo() {
   JsonDocument doc;
   doc["project"] = "ESP8266 Clock";
   doc["status"] = "ok";
-  doc["endpoints"] = F("/config.json, /api/power, /api/time, /api/display, /api/dots, /api/alarm, /api/sinric, /api/info");
+  doc["endpoints"] = F("/config.json, /api/config, /api/power, /api/time, /api/fleet, /api/display, /api/schedule, /api/schedule/curve, /api/dots, /api/alarm, /api/timer, /api/message, /api/animation, /api/sinric, /api/stats, /api/output, /api/layout, /api/info");
+  sendJson(doc);
+}
+
+void handleGetStats() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  JsonObject frames = root["frames"].to<JsonObject>();
+  frames["output"] = ledOutput.name();
+  frames["pushed"] = frameStats.pushed;
+  frames["skipped"] = frameStats.skipped;
+  frames["deferred"] = frameStats.deferred;
+  frames["last_show_us"] = frameStats.lastShowUs;
+  frames["max_show_us"] = frameStats.maxShowUs;
+  frames["last_render_us"] = frameStats.lastRenderUs;
+  frames["max_render_us"] = frameStats.maxRenderUs;
+  frames["over_budget"] = frameStats.overBudget;
+  frames["budget_us"] = FRAME_BUDGET_US;
+  frames["dithering"] = ditherActive;
+#ifdef UMM_STATS_FULL
+  frames["allocating"] = frameStats.allocatingFrames;
+  frames["last_allocations"] = frameStats.lastAllocations;
+#endif
+  JsonObject heap = root["heap"].to<JsonObject>();
+  heap["free"] = ESP.getFreeHeap();
+  heap["min_free"] = frameStats.minFreeHeap;
+  heap["max_block"] = ESP.getMaxFreeBlockSize();
+  heap["fragmentation"] = ESP.getHeapFragmentation();
+  JsonObject animation = root["animation"].to<JsonObject>();
+  animation["transitions"] = animationStats.transitions;
+  animation["frames"] = animationStats.frames;
+  animation["throttled"] = animationStats.throttled;
+  animation["max_loop_gap_us"] = animationStats.maxLoopGapUs;
+  animation["loop_gaps_over_target"] = animationStats.loopGapsOverTarget;
+  animation["loop_gap_target_us"] = HTTP_LATENCY_TARGET_US;
+  JsonObject effects = root["effects"].to<JsonObject>();
+  for (uint8_t i = 1; i < EFFECT_COUNT; ++i) {
+    const EffectStats &stats = effectStats[i];
+    JsonObject entry = effects[effectToString(static_cast<EffectKind>(i))].to<JsonObject>();
+    entry["frames"] = stats.frames;
+    entry["last_us"] = stats.lastUs;
+    entry["max_us"] = stats.maxUs;
+    entry["avg_us"] = stats.frames > 0 ? stats.totalUs / stats.frames : 0;
+  }
+  JsonObject schedule = root["schedule"].to<JsonObject>();
+  schedule["renders"] = schedulerStats.renders;
+  schedule["event_wakeups"] = schedulerStats.eventWakeups;
+  schedule["renders_per_hour"] = static_cast<uint32_t>(
+      (static_cast<uint64_t>(schedulerStats.renders) * 3600000ULL) / max(millis(), 1UL));
+  schedule["next_refresh_in_ms"] = static_cast<int32_t>(displaySchedule.nextRefreshMs - millis());
+  schedule["clock_changes"] = schedulerStats.clockChanges;
+  schedule["last_change_latency_ms"] = schedulerStats.lastChangeLatencyMs;
+  schedule["max_change_latency_ms"] = schedulerStats.maxChangeLatencyMs;
+  schedule["latency_over_target"] = schedulerStats.latencyOverTarget;
+  schedule["latency_target_ms"] = DISPLAY_LATENCY_TARGET_MS;
+  JsonObject queue = root["commands"].to<JsonObject>();
+  queue["posted"] = commands.posted;
+  queue["collapsed"] = commands.collapsed;
+  queue["applies"] = commands.applies;
+  queue["renders"] = commands.renders;
+  queue["pending"] = commands.count;
+  queue["max_depth"] = commands.maxDepth;
+  queue["last_apply_us"] = commands.lastApplyUs;
+  queue["max_apply_us"] = commands.maxApplyUs;
+  JsonObject persistence = root["config"].to<JsonObject>();
+  persistence["dirty"] = configStore.dirty;
+  persistence["pending_ms"] = configStore.dirty ? millis() - configStore.firstChangeMs : 0;
+  persistence["requests"] = configStore.requests;
+  persistence["writes"] = configStore.writes;
+  persistence["unchanged"] = configStore.unchanged;
+  persistence["coalesced"] = configStore.requests - min(configStore.requests, configStore.writes + configStore.unchanged);
+  persistence["failures"] = configStore.failures;
+  persistence["bytes_written"] = configStore.bytesWritten;
+  persistence["last_write_us"] = configStore.lastWriteUs;
+  persistence["max_write_us"] = configStore.maxWriteUs;
+  persistence["quiet_ms"] = CONFIG_SAVE_QUIET_MS;
+  persistence["loaded_from"] = configStore.loadedFrom;
+  persistence["load_us"] = configStore.loadUs;
+  persistence["slot"] = configStore.activeSlot;
+  persistence["sequence"] = configStore.sequence;
+  persistence["record_bytes"] = sizeof(ConfigRecord);
+  persistence["record_version"] = CONFIG_RECORD_VERSION;
+  root["uptime_ms"] = millis();
+  sendJson(doc);
+}
+
+void handleGetLayout() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["source"] = layoutFromFile ? "littlefs" : "compiled";
+  root["digits"] = activeLayout.digitCount;
+  root["leds_per_segment"] = activeLayout.ledsPerSegment;
+  root["led_count"] = activeLayout.ledCount;
+  JsonArray order = root["segment_order"].to<JsonArray>();
+  for (uint8_t position = 0; position < SEGMENTS_PER_DIGIT; ++position) {
+    for (uint8_t segment = 0; segment < SEGMENTS_PER_DIGIT; ++segment) {
+      if (activeLayout.segmentSlot[segment] == position) {
+        order.add(String(static_cast<char>('a' + segment)));
+      }
+    }
+  }
+  JsonArray bases = root["digit_base"].to<JsonArray>();
+  for (uint8_t digit = 0; digit < activeLayout.digitCount; ++digit) {
+    bases.add(activeLayout.digitBase[digit]);
+  }
+  JsonArray dots = root["dots"].to<JsonArray>();
+  for (uint8_t dot = 0; dot < activeLayout.dotCount; ++dot) {
+    dots.add(activeLayout.dotIndex[dot]);
+  }
+  sendJson(doc);
+}
+
+void handleGetOutput() {
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["backend"] = ledOutput.name();
+  root["led_count"] = activeLayout.ledCount;
+  root["last_show_us"] = frameStats.lastShowUs;
+  root["max_show_us"] = frameStats.maxShowUs;
+#if LED_OUTPUT_BACKEND == LED_OUTPUT_RECORDING
+  root["recorded"] = ledOutputDriver.recorded();
+  JsonArray frames = root["frames"].to<JsonArray>();
+  uint32_t sequence = 0;
+  const uint8_t *grb = nullptr;
+  size_t length = 0;
+  for (uint8_t age = 0; ledOutputDriver.frame(age, sequence, grb, length); ++age) {
+    JsonObject frame = frames.add<JsonObject>();
+    frame["sequence"] = sequence;
+    String bitstream;
+    bitstream.reserve(length * 8);
+    char word[9];
+    for (size_t i = 0; i < length; ++i) {
+      snprintf(word, sizeof(word), "%08X", static_cast<unsigned>(encodeWs2812Byte(grb[i])));
+      bitstream += word;
+    }
+    frame["i2s_words"] = bitstream;
+  }
+#endif
+  sendJson(doc);
+}
+
+void handleGetAnimation() {
+  AnimationPlayer &player = animationPlayer;
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["loaded"] = player.open;
+  if (player.open) {
+    root["fps"] = player.header.fps;
+    root["led_count"] = player.header.ledCount;
+    root["frame_count"] = player.header.frameCount;
+    root["loop"] = (player.header.flags & ANIMATION_FLAG_LOOP) != 0;
+    root["frame"] = player.frameIndex;
+    root["finished"] = player.finished;
+    root["size"] = player.file.size();
+  }
+  root["playing"] = isEffectRunning(config.power.powerOn ? config.power.mode : OperatingMode::Off) &&
+                    config.display.effect.kind == EffectKind::Animation;
+  JsonObject stats = root["stats"].to<JsonObject>();
+  stats["frames"] = player.framesDecoded;
+  stats["late"] = player.framesLate;
+  stats["errors"] = player.decodeErrors;
+  stats["measured_fps"] = player.measuredFps;
+  stats["last_decode_us"] = player.lastDecodeUs;
+  stats["max_decode_us"] = player.maxDecodeUs;
+  stats["min_free_heap"] = player.minFreeHeap;
+  stats["buffer_bytes"] = ANIMATION_BUFFER_BYTES;
   sendJson(doc);
 }
 
+// Multipart upload, written to a temporary file and swapped in only once its header is valid.
+File animationUpload;
+
+void handleAnimationUpload() {
+  HTTPUpload &upload = server.upload();
+  switch (upload.status) {
+    case UPLOAD_FILE_START:
+      closeAnimation();
+      animationUpload = LittleFS.open(ANIMATION_UPLOAD_PATH, "w");
+      break;
+    case UPLOAD_FILE_WRITE:
+      if (animationUpload) {
+        animationUpload.write(upload.buf, upload.currentSize);
+      }
+      break;
+    case UPLOAD_FILE_END:
+      if (animationUpload) {
+        animationUpload.close();
+      }
+      break;
+    case UPLOAD_FILE_ABORTED:
+      if (animationUpload) {
+        animationUpload.close();
+      }
+      LittleFS.remove(ANIMATION_UPLOAD_PATH);
+      openAnimation();
+      break;
+  }
+}
+
+void handlePostAnimation() {
+  File file = LittleFS.open(ANIMATION_UPLOAD_PATH, "r");
+  if (!file) {
+    openAnimation();
+    sendJsonError("Missing animation file");
+    return;
+  }
+  uint8_t bytes[ANIMATION_HEADER_BYTES];
+  AnimationHeader header;
+  const bool validHeader =
+      file.read(bytes, sizeof(bytes)) == sizeof(bytes) && parseAnimationHeader(bytes, header);
+  const bool validRecords = validHeader && validateAnimationRecords(file, header);
+  file.close();
+  if (!validRecords) {
+    LittleFS.remove(ANIMATION_UPLOAD_PATH);
+    openAnimation();
+    sendJsonError(validHeader ? "Truncated or invalid animation records" : "Invalid animation header");
+    return;
+  }
+  LittleFS.remove(ANIMATION_PATH);
+  LittleFS.rename(ANIMATION_UPLOAD_PATH, ANIMATION_PATH);
+  openAnimation();
+  requestApply(APPLY_REFRESH);
+  handleGetAnimation();
+}
+
+void handleDeleteAnimation() {
+  closeAnimation();
+  LittleFS.remove(ANIMATION_PATH);
+  requestApply(APPLY_REFRESH);
+  handleGetAnimation();
+}
+
 void handleNotFound() {
   sendJsonError("Endpoint not found", 404);
 }
@@ -1063,10 +5150,18 @@ void setupWebServer() {
   server.on("/api/time", HTTP_GET, handleGetTime);
   server.on("/api/time", HTTP_POST, handlePostTime);
   server.on("/api/time", HTTP_OPTIONS, handleCorsPreflight);
+  server.on("/api/fleet", HTTP_GET, handleGetFleet);
+  server.on("/api/fleet", HTTP_POST, handlePostFleet);
+  server.on("/api/fleet", HTTP_OPTIONS, handleCorsPreflight);
 
   server.on("/api/display", HTTP_GET, handleGetDisplay);
   server.on("/api/display", HTTP_POST, handlePostDisplay);
   server.on("/api/display", HTTP_OPTIONS, handleCorsPreflight);
+  server.on("/api/schedule", HTTP_GET, handleGetSchedule);
+  server.on("/api/schedule", HTTP_POST, handlePostSchedule);
+  server.on("/api/schedule", HTTP_OPTIONS, handleCorsPreflight);
+  server.on("/api/schedule/curve", HTTP_GET, handleGetScheduleCurve);
+  server.on("/api/schedule/curve", HTTP_OPTIONS, handleCorsPreflight);
 
   server.on("/api/dots", HTTP_GET, handleGetDots);
   server.on("/api/dots", HTTP_POST, handlePostDots);
@@ -1075,13 +5170,31 @@ void setupWebServer() {
   server.on("/api/alarm", HTTP_GET, handleGetAlarm);
   server.on("/api/alarm", HTTP_POST, handlePostAlarm);
   server.on("/api/alarm", HTTP_OPTIONS, handleCorsPreflight);
+  server.on("/api/timer", HTTP_GET, handleGetTimer);
+  server.on("/api/timer", HTTP_POST, handlePostTimer);
+  server.on("/api/timer", HTTP_OPTIONS, handleCorsPreflight);
+
+  server.on("/api/message", HTTP_GET, handleGetMessage);
+  server.on("/api/message", HTTP_POST, handlePostMessage);
+  server.on("/api/message", HTTP_OPTIONS, handleCorsPreflight);
+
+  server.on("/api/animation", HTTP_GET, handleGetAnimation);
+  server.on("/api/animation", HTTP_POST, handlePostAnimation, handleAnimationUpload);
+  server.on("/api/animation", HTTP_DELETE, handleDeleteAnimation);
+  server.on("/api/animation", HTTP_OPTIONS, handleCorsPreflight);
 
   server.on("/api/sinric", HTTP_GET, handleGetSinric);
   server.on("/api/sinric", HTTP_POST, handlePostSinric);
   server.on("/api/sinric", HTTP_OPTIONS, handleCorsPreflight);
 
+  server.on("/api/stats", HTTP_GET, handleGetStats);
+  server.on("/api/output", HTTP_GET, handleGetOutput);
+  server.on("/api/layout", HTTP_GET, handleGetLayout);
   server.on("/api/info", HTTP_GET, handleInfo);
   server.on("/config.json", HTTP_GET, handleGetConfigFile);
+  server.on("/api/config", HTTP_GET, handleGetConfigFile);
+  server.on("/api/config", HTTP_PATCH, handlePatchConfig);
+  server.on("/api/config", HTTP_OPTIONS, handleCorsPreflight);
 
   server.onNotFound(handleNotFound);
   server.begin();
@@ -1100,18 +5213,17 @@ int brightnessToSinricPercent(uint8_t brightness) {
 }
 
 bool hasValidSinricCredentials() {
-  return config.sinric.enabled && config.sinric.appKey.length() > 0 && config.sinric.appSecret.length() > 0 &&
-         config.sinric.deviceId.length() > 0;
+  return config.sinric.enabled && hasStoredSinricCredentials();
 }
 
 bool hasStoredSinricCredentials() {
-  return config.sinric.appKey.length() > 0 && config.sinric.appSecret.length() > 0 && config.sinric.deviceId.length() > 0;
+  return config.sinric.appKey[0] != '\0' && config.sinric.appSecret[0] != '\0' && config.sinric.deviceId[0] != '\0';
 }
 
 void handleGetSinric() {
   JsonDocument doc;
   JsonObject root = doc.to<JsonObject>();
-  root["enabled"] = config.sinric.enabled;
+  writeConfigFields(root, "sinric");
   root["configured"] = hasStoredSinricCredentials();
   root["active"] = sinricInitialized;
   sendJson(doc);
@@ -1124,29 +5236,32 @@ void handlePostSinric() {
     sendJsonError("Invalid JSON payload");
     return;
   }
-  if (!doc["enabled"].isNull()) {
-    config.sinric.enabled = doc["enabled"].as<bool>();
-  }
-  auto updateSecret = [](String &target, const JsonVariantConst &value) {
+  readConfigFields(doc.as<JsonObjectConst>(), "sinric");
+  bool fits = true;
+  auto updateSecret = [&fits](auto &target, const JsonVariantConst &value) {
     if (!value.isNull()) {
       String incoming = value.as<String>();
       incoming.trim();
-      if (incoming.length() > 0) {
-        target = incoming;
+      if (incoming.length() > 0 && !setText(target, incoming.c_str())) {
+        fits = false;
       }
     }
   };
   updateSecret(config.sinric.appKey, doc["app_key"]);
   updateSecret(config.sinric.appSecret, doc["app_secret"]);
   updateSecret(config.sinric.deviceId, doc["device_id"]);
+  if (!fits) {
+    sendJsonError("Sinric credential too long");
+    return;
+  }
 
-  saveConfig();
-  setupSinric();
+  setupSinric();  // the reply reports whether the connection started
+  requestApply(APPLY_PERSIST);
   handleGetSinric();
 }
 
 void notifySinricState() {
-  if (!sinricInitialized || sinricCommandInProgress || sinricLightDevice == nullptr) {
+  if (!sinricInitialized || sinricLightDevice == nullptr) {
     return;
   }
   sinricLightDevice->sendPowerStateEvent(config.power.powerOn);
@@ -1159,11 +5274,11 @@ bool onSinricPowerState(const String &deviceId, bool &state) {
   if (!deviceId.equals(config.sinric.deviceId)) {
     return false;
   }
-  sinricCommandInProgress = true;
-  config.power.powerOn = state;
-  saveConfig();
-  updateDisplay();
-  sinricCommandInProgress = false;
+  Command command;
+  command.type = CommandType::SetPower;
+  command.source = CommandSource::Cloud;
+  command.powerOn = state;
+  postCommand(command);
   return true;
 }
 
@@ -1171,12 +5286,11 @@ bool onSinricBrightness(const String &deviceId, int &brightness) {
   if (!deviceId.equals(config.sinric.deviceId)) {
     return false;
   }
-  sinricCommandInProgress = true;
-  config.display.brightness = sinricPercentToBrightness(brightness);
-  applyDisplaySettings();
-  saveConfig();
-  updateDisplay();
-  sinricCommandInProgress = false;
+  Command command;
+  command.type = CommandType::SetBrightness;
+  command.source = CommandSource::Cloud;
+  command.brightness = sinricPercentToBrightness(brightness);
+  postCommand(command);
   return true;
 }
 
@@ -1184,16 +5298,11 @@ bool onSinricColor(const String &deviceId, byte &r, byte &g, byte &b) {
   if (!deviceId.equals(config.sinric.deviceId)) {
     return false;
   }
-  sinricCommandInProgress = true;
-  config.display.generalColor = Color(r, g, b);
-  if (!config.display.perDigitEnabled) {
-    for (uint8_t i = 0; i < DIGIT_COUNT; ++i) {
-      config.display.perDigitColor[i] = config.display.generalColor;
-    }
-  }
-  saveConfig();
-  updateDisplay();
-  sinricCommandInProgress = false;
+  Command command;
+  command.type = CommandType::SetColor;
+  command.source = CommandSource::Cloud;
+  command.color = Color(r, g, b);
+  postCommand(command);
   return true;
 }
 
@@ -1210,11 +5319,11 @@ void setupSinric() {
 #endif
     return;
   }
-  SinricProLight &device = SinricPro[config.sinric.deviceId.c_str()];
+  SinricProLight &device = SinricPro[config.sinric.deviceId];
   device.onPowerState(onSinricPowerState);
   device.onBrightness(onSinricBrightness);
   device.onColor(onSinricColor);
-  SinricPro.begin(config.sinric.appKey.c_str(), config.sinric.appSecret.c_str());
+  SinricPro.begin(config.sinric.appKey, config.sinric.appSecret);
   SinricPro.restoreDeviceStates(false);
   sinricLightDevice = &device;
   sinricInitialized = true;
@@ -1228,69 +5337,449 @@ void processSinric() {
   SinricPro.handle();
 }
 
-bool syncTimeFromNtp() {
+const char *ntpStateToString(NtpState state) {
+  switch (state) {
+    case NtpState::Resolving:
+      return "resolving";
+    case NtpState::Waiting:
+      return "waiting";
+    case NtpState::Idle:
+      break;
+  }
+  return "idle";
+}
+
+void resetNtpServerState(uint8_t index) {
+  ntpClient.servers[index] = NtpServerState();
+}
+
+void finishNtpSync(const char *result) {
+  ntpClient.state = NtpState::Idle;
+  ntpClient.lastResult = result;
+  ++ntpClient.generation;
+  if (strcmp(result, "ok") == 0) {
+    ++ntpClient.successes;
+  } else {
+    ++ntpClient.failures;
+#ifdef DEBUG_SERIAL
+    Serial.print(F("[Clock] NTP sync failed: "));
+    Serial.println(result);
+#endif  // DEBUG_SERIAL
+  }
+}
+
+// Runs in the lwIP context: only records the result, serviceNtp() acts on it.
+void onNtpDnsFound(const char *name, const ip_addr_t *ipaddr, void *arg) {
+  (void)name;
+  if (reinterpret_cast<uintptr_t>(arg) != ntpClient.generation) {
+    return;
+  }
+  ntpClient.dnsOk = ipaddr != nullptr;
+  if (ipaddr != nullptr) {
+    ntpClient.dnsResult = IPAddress(ipaddr);
+  }
+  ntpClient.dnsDone = true;
+}
+
+// Sends to and receives from the current server for NtpExchange.
+struct NtpServerUdp {
+  bool send(const uint8_t *packet, size_t size) {
+    while (ntpClient.udp.parsePacket() > 0) {
+      // parsePacket() discards the previous datagram: drops late replies to an older request
+    }
+    ntpClient.udp.beginPacket(ntpClient.servers[ntpClient.serverIndex].address, NTP_PORT);
+    ntpClient.udp.write(packet, size);
+    return ntpClient.udp.endPacket() == 1;
+  }
+  int receive(uint8_t *packet, size_t size) {
+    const int length = ntpClient.udp.parsePacket();
+    if (length <= 0) {
+      return 0;
+    }
+    if (ntpClient.udp.remoteIP() != ntpClient.servers[ntpClient.serverIndex].address) {
+      return -1;
+    }
+    ntpClient.udp.read(packet, size);
+    return length;
+  }
+};
+
+void sendNtpRequest() {
+  NtpServerUdp udp;
+  ntpClient.exchange.send(udp, millis(), ntpClient.generation);
+  ntpClient.requestSentLocalMs = monotonicMillis();
+  ntpClient.stateStartMs = ntpClient.exchange.sentMs;
+  ntpClient.state = NtpState::Waiting;
+}
+
+void beginNtpServer(uint8_t index);
+
+void failNtpServer() {
+  ++ntpClient.servers[ntpClient.serverIndex].failures;
+  beginNtpServer(ntpClient.serverIndex + 1);
+}
+
+void acceptNtpAddress(const IPAddress &address) {
+  NtpServerState &server = ntpClient.servers[ntpClient.serverIndex];
+  server.address = address;
+  server.resolved = true;
+  server.resolvedMs = millis();
+  sendNtpRequest();
+}
+
+// A failed lookup falls back to the previous address rather than skipping the server.
+void useStaleNtpAddress() {
+  if (ntpClient.servers[ntpClient.serverIndex].resolved) {
+    sendNtpRequest();
+  } else {
+    failNtpServer();
+  }
+}
+
+void finishNtpRound();
+
+void beginNtpServer(uint8_t index) {
+  ntpClient.serverIndex = index;
+  ntpClient.serverSamples = 0;
+  ntpClient.exchange.attempt = 0;
+  if (index >= config.network.ntpServerCount) {
+    finishNtpRound();
+    return;
+  }
+  NtpServerState &server = ntpClient.servers[index];
+  const unsigned long nowMs = millis();
+  if (server.resolved && nowMs - server.resolvedMs < NTP_DNS_CACHE_TTL_MS) {
+    ++server.cacheHits;
+    sendNtpRequest();
+    return;
+  }
+  ++server.lookups;
+  ++ntpClient.generation;
+  ntpClient.dnsDone = false;
+  ntpClient.stateStartMs = nowMs;
+  ntpClient.state = NtpState::Resolving;
+  ip_addr_t address;
+  const err_t err = dns_gethostbyname(config.network.ntpServers[index], &address, onNtpDnsFound,
+                                      reinterpret_cast<void *>(static_cast<uintptr_t>(ntpClient.generation)));
+  if (err == ERR_OK) {
+    acceptNtpAddress(IPAddress(&address));  // literal or lwIP-cached address
+  } else if (err != ERR_INPROGRESS) {
+    useStaleNtpAddress();
+  }
+}
+
+// The local send and receive times are read on the time base being disciplined.
+void recordNtpSample(const uint8_t *packet, unsigned long receivedMs) {
+  NtpServerState &server = ntpClient.servers[ntpClient.serverIndex];
+  const uint64_t receivedLocalMs = monotonicMillis() - (millis() - receivedMs);
+  const NtpMeasurement measurement =
+      measureNtpReply(packet, static_cast<int64_t>(epochMillisAt(ntpClient.requestSentLocalMs)),
+                      static_cast<int64_t>(epochMillisAt(receivedLocalMs)));
+  const int64_t rtt = measurement.rttMs;
+  server.lastOffsetMs = measurement.offsetMs;
+  server.lastRttMs = rtt > 0 ? static_cast<uint32_t>(rtt) : 0;
+  server.minRttMs = min(server.minRttMs, server.lastRttMs);
+  ++server.samples;
+  if (rtt < 0 || rtt > static_cast<int64_t>(NTP_MAX_RTT_MS)) {
+    ++server.rejected;
+    return;
+  }
+  NtpSample &sample = ntpClient.samples[ntpClient.sampleCount++];
+  sample.server = ntpClient.serverIndex;
+  sample.offsetMs = server.lastOffsetMs;
+  sample.rttMs = server.lastRttMs;
+}
+
+template <typename Less>
+void sortNtpSamples(NtpSample *samples, uint8_t count, Less less) {
+  for (uint8_t i = 1; i < count; ++i) {
+    const NtpSample sample = samples[i];
+    uint8_t j = i;
+    for (; j > 0 && less(sample, samples[j - 1]); --j) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = sample;
+  }
+}
+
+// Samples far from the median offset are dropped (a server with a wrong clock), then the
+// offsets of the best half by round trip (least exposed to path asymmetry) are averaged.
+void finishNtpRound() {
+  NtpSample *samples = ntpClient.samples;
+  uint8_t count = ntpClient.sampleCount;
+  for (NtpServerState &server : ntpClient.servers) {
+    server.selected = false;
+  }
+  if (count == 0) {
+    finishNtpSync("no_valid_samples");
+    return;
+  }
+
+  sortNtpSamples(samples, count, [](const NtpSample &a, const NtpSample &b) { return a.offsetMs < b.offsetMs; });
+  const int64_t median =
+      (count & 1) ? samples[count / 2].offsetMs : (samples[count / 2 - 1].offsetMs + samples[count / 2].offsetMs) / 2;
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    const int64_t distance = samples[i].offsetMs - median;
+    if (distance > static_cast<int64_t>(NTP_OUTLIER_MS) || distance < -static_cast<int64_t>(NTP_OUTLIER_MS)) {
+      ++ntpClient.servers[samples[i].server].rejected;
+    } else {
+      samples[kept++] = samples[i];
+    }
+  }
+  sortNtpSamples(samples, kept, [](const NtpSample &a, const NtpSample &b) { return a.rttMs < b.rttMs; });
+  const uint8_t used = max<uint8_t>(1, (kept + 1) / 2);
+  int64_t offsetSum = 0;
+  for (uint8_t i = 0; i < used; ++i) {
+    offsetSum += samples[i].offsetMs;
+    ntpClient.servers[samples[i].server].selected = true;
+  }
+  const int64_t offsetMs = offsetSum / used;
+
+  const uint64_t localMs = monotonicMillis();
+  const uint64_t ntpEpochMs = static_cast<uint64_t>(static_cast<int64_t>(epochMillisAt(localMs)) + offsetMs);
+  disciplineTimeBase(ntpEpochMs, localMs);
+  recordBootSync();
+  saveRtcCheckpoint();
+
+  config.time = computeCurrentTime();
+  const bool firstSync = lastNtpSyncMs == 0;
+  lastNtpSyncMs = millis();
+  ntpClient.lastRttMs = samples[0].rttMs;
+  ntpClient.lastOffsetMs = offsetMs;
+  ntpClient.lastSamplesUsed = used;
+  finishNtpSync("ok");
+#ifdef DEBUG_SERIAL
+  Serial.printf("[Clock] NTP sync OK: %02u:%02u:%02u (%u samples, best rtt %u ms)\n", config.time.hour,
+                config.time.minute, config.time.second, used, static_cast<unsigned>(ntpClient.lastRttMs));
+#endif  // DEBUG_SERIAL
+  refreshDisplay();  // the time may have stepped, the next wake-up moves with it
+  if (firstSync) {
+    requestConfigSave();
+  }
+}
+
+// Starts a sync round in the background; the result shows up in /api/time once it is done.
+bool startNtpSync() {
   if (WiFi.status() != WL_CONNECTED) {
 #ifdef DEBUG_SERIAL
     Serial.println(F("[Clock] Cannot sync time: WiFi not connected"));
 #endif  // DEBUG_SERIAL
     return false;
   }
-  if (config.network.ntpServer.length() == 0) {
+  if (config.network.ntpServerCount == 0) {
 #ifdef DEBUG_SERIAL
     Serial.println(F("[Clock] Cannot sync time: NTP server not configured"));
 #endif  // DEBUG_SERIAL
     return false;
   }
+  if (!ntpClient.udpOpen) {
+    ntpClient.udpOpen = ntpClient.udp.begin(NTP_LOCAL_PORT) == 1;
+    if (!ntpClient.udpOpen) {
+      return false;
+    }
+  }
 
   lastNtpAttemptMs = millis();
 #ifdef DEBUG_SERIAL
-  Serial.print(F("[Clock] Syncing time via NTP: "));
-  Serial.println(config.network.ntpServer);
+  Serial.printf("[Clock] Syncing time via NTP (%u servers)\n", config.network.ntpServerCount);
 #endif  // DEBUG_SERIAL
-  configTime(0, 0, config.network.ntpServer.c_str());
-
-  for (uint8_t attempt = 0; attempt < NTP_MAX_ATTEMPTS; ++attempt) {
-    time_t now = time(nullptr);
-    if (now > 100000) {
-      const int32_t offsetSeconds = static_cast<int32_t>(config.network.utcOffsetMinutes) * 60;
-      time_t adjusted = now + offsetSeconds;
-      struct tm timeInfo;
-#if defined(ESP8266)
-      if (gmtime_r(&adjusted, &timeInfo) == nullptr) {
-        delay(NTP_RETRY_DELAY_MS);
-        yield();
-        continue;
+  ++ntpClient.generation;
+  ntpClient.sampleCount = 0;
+  beginNtpServer(0);
+  return true;
+}
+
+void serviceNtp() {
+  if (ntpClient.state == NtpState::Idle) {
+    return;
+  }
+  const unsigned long startUs = micros();
+  const unsigned long nowMs = millis();
+  switch (ntpClient.state) {
+    case NtpState::Resolving:
+      if (ntpClient.dnsDone) {
+        if (ntpClient.dnsOk) {
+          acceptNtpAddress(ntpClient.dnsResult);
+        } else {
+          useStaleNtpAddress();
+        }
+      } else if (nowMs - ntpClient.stateStartMs >= NTP_DNS_TIMEOUT_MS) {
+        useStaleNtpAddress();
       }
-#else
-      struct tm *tmp = gmtime(&adjusted);
-      if (!tmp) {
-        delay(NTP_RETRY_DELAY_MS);
-        yield();
-        continue;
+      break;
+    case NtpState::Waiting: {
+      NtpServerUdp udp;
+      uint8_t packet[NTP_PACKET_BYTES];
+      switch (ntpClient.exchange.poll(udp, nowMs, NTP_REPLY_TIMEOUT_MS, NTP_MAX_ATTEMPTS, packet)) {
+        case NtpPoll::Reply:
+          recordNtpSample(packet, nowMs);
+          if (++ntpClient.serverSamples < NTP_SAMPLES_PER_SERVER) {
+            ntpClient.exchange.attempt = 0;
+            sendNtpRequest();
+          } else {
+            beginNtpServer(ntpClient.serverIndex + 1);
+          }
+          break;
+        case NtpPoll::Unusable:
+          ++ntpClient.servers[ntpClient.serverIndex].rejected;
+          failNtpServer();
+          break;
+        case NtpPoll::Timeout:
+          ++ntpClient.timeouts;
+          sendNtpRequest();
+          break;
+        case NtpPoll::Failed:
+          ++ntpClient.timeouts;
+          failNtpServer();
+          break;
+        case NtpPoll::Pending:
+          break;
       }
-      timeInfo = *tmp;
-#endif
-      config.time.hour = constrain(timeInfo.tm_hour, 0, 23);
-      config.time.minute = constrain(timeInfo.tm_min, 0, 59);
-      config.time.second = constrain(timeInfo.tm_sec, 0, 59);
-      timeAnchor = config.time;
-      timeReferenceMs = millis();
-      lastNtpSyncMs = millis();
-      lastNtpAttemptMs = lastNtpSyncMs;
-#ifdef DEBUG_SERIAL
-      Serial.printf("[Clock] NTP sync OK: %02u:%02u:%02u\n", config.time.hour, config.time.minute,
-                    config.time.second);
-#endif  // DEBUG_SERIAL
-      return true;
+      break;
     }
-    delay(NTP_RETRY_DELAY_MS);
-    yield();
+    case NtpState::Idle:
+      break;
+  }
+  ntpClient.maxServiceUs = max(ntpClient.maxServiceUs, static_cast<uint32_t>(micros() - startUs));
+}
+
+// Beacon, network byte order: magic "7CLS", version, flags (bit 0: leader synced to NTP),
+// sequence (16 bits), leader id (32 bits), leader epoch ms (64 bits).
+constexpr uint8_t FLEET_MAGIC[4] = {'7', 'C', 'L', 'S'};
+constexpr uint8_t FLEET_VERSION = 1;
+
+void writeBigEndian(uint8_t *target, uint64_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; ++i) {
+    target[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+  }
+}
+
+uint64_t readBigEndian(const uint8_t *source, uint8_t bytes) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | source[i];
   }
+  return value;
+}
 
+// (Re)joins the multicast group for the configured role. Modem sleep is disabled while the
+// fleet runs: the access point holds multicast frames until the next DTIM otherwise, which
+// delays beacons by up to a few hundred milliseconds.
+void applyFleetConfig() {
+  if (fleet.open) {
+    fleet.udp.stop();
+    fleet.open = false;
+  }
+  fleet.leaderId = 0;
+  fleet.window.reset();
+  if (config.network.fleetRole == FleetRole::Off) {
+    WiFi.setSleepMode(WIFI_MODEM_SLEEP);
+    return;
+  }
+  if (WiFi.status() != WL_CONNECTED || !fleet.group.fromString(config.network.fleetGroup)) {
+    return;  // retried from serviceFleetSync()
+  }
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  fleet.open = fleet.udp.beginMulticast(WiFi.localIP(), fleet.group, config.network.fleetPort) == 1;
 #ifdef DEBUG_SERIAL
-  Serial.println(F("[Clock] Failed to sync time via NTP"));
-#endif  // DEBUG_SERIAL
-  return false;
+  Serial.printf("[Fleet] %s on %s:%u %s\n", fleetRoleToString(config.network.fleetRole),
+                config.network.fleetGroup, config.network.fleetPort, fleet.open ? "ready" : "failed");
+#endif
+}
+
+void sendFleetBeacon() {
+  uint8_t packet[FLEET_PACKET_BYTES];
+  memcpy(packet, FLEET_MAGIC, sizeof(FLEET_MAGIC));
+  packet[4] = FLEET_VERSION;
+  packet[5] = timeBase.synced ? 1 : 0;
+  writeBigEndian(packet + 6, ++fleet.sequence, 2);
+  writeBigEndian(packet + 8, ESP.getChipId(), 4);
+  fleet.udp.beginPacketMulticast(fleet.group, config.network.fleetPort, WiFi.localIP());
+  writeBigEndian(packet + 12, currentEpochMillis(), 8);  // sampled as late as possible
+  fleet.udp.write(packet, sizeof(packet));
+  fleet.udp.endPacket();
+  fleet.lastSendMs = millis();
+  ++fleet.beaconsSent;
+}
+
+// Each beacon gives a one-way offset; FleetWindow keeps the least delayed one of a window.
+void handleFleetBeacon(const uint8_t *packet, uint64_t receivedLocalMs) {
+  const uint32_t leaderId = static_cast<uint32_t>(readBigEndian(packet + 8, 4));
+  const unsigned long nowMs = millis();
+  if (leaderId == ESP.getChipId()) {
+    return;  // our own beacon, looped back by the group
+  }
+  if (config.network.fleetRole != FleetRole::Follower ||
+      (fleet.leaderId != 0 && leaderId != fleet.leaderId && nowMs - fleet.lastBeaconMs < FLEET_LOCK_TIMEOUT_MS)) {
+    ++fleet.beaconsIgnored;
+    return;
+  }
+  if (leaderId != fleet.leaderId) {
+    fleet.leaderId = leaderId;
+    fleet.window.reset();
+  }
+  fleet.leaderIp = fleet.udp.remoteIP();
+  fleet.leaderSynced = (packet[5] & 1) != 0;
+  fleet.lastBeaconMs = nowMs;
+  ++fleet.beaconsReceived;
+
+  const uint64_t leaderEpochMs = readBigEndian(packet + 12, 8);
+  const int64_t offsetMs = static_cast<int64_t>(leaderEpochMs - epochMillisAt(receivedLocalMs));
+  fleet.lastOffsetMs = static_cast<int32_t>(constrain(offsetMs, -2147483647LL, 2147483647LL));
+  int64_t correctionMs;
+  if (!fleet.window.add(offsetMs, FLEET_WINDOW_BEACONS, correctionMs)) {
+    return;
+  }
+  if (!fleet.leaderSynced && timeBase.synced) {
+    return;  // an unsynced leader only helps clocks that have no time either
+  }
+  const bool step = alignTimeBasePhase(correctionMs);
+  if (fleet.leaderSynced && !timeBase.synced) {
+    timeBase.synced = true;  // no NTP reply yet: the leader's time is the best available
+    invalidateAlarmIndex();
+  }
+  fleet.lastCorrectionMs = static_cast<int32_t>(constrain(correctionMs, -2147483647LL, 2147483647LL));
+  ++fleet.alignments;
+  if (step) {
+    ++fleet.steps;
+    refreshDisplay();
+  } else {
+    scheduleDisplayRefresh();  // the next digit change moves with the slew
+  }
+}
+
+// Polled from loop(): drains received beacons and sends the leader's on schedule.
+void serviceFleetSync() {
+  if (config.network.fleetRole == FleetRole::Off) {
+    return;
+  }
+  if (!fleet.open) {
+    if (WiFi.status() == WL_CONNECTED && millis() - fleet.lastSendMs >= FLEET_LOCK_TIMEOUT_MS) {
+      fleet.lastSendMs = millis();  // throttles the retries
+      applyFleetConfig();
+    }
+    return;
+  }
+  int size;
+  while ((size = fleet.udp.parsePacket()) > 0) {
+    const uint64_t receivedLocalMs = monotonicMillis();
+    uint8_t packet[FLEET_PACKET_BYTES];
+    if (size != static_cast<int>(sizeof(packet)) || fleet.udp.read(packet, sizeof(packet)) != size ||
+        memcmp(packet, FLEET_MAGIC, sizeof(FLEET_MAGIC)) != 0 || packet[4] != FLEET_VERSION) {
+      ++fleet.beaconsIgnored;
+      continue;
+    }
+    handleFleetBeacon(packet, receivedLocalMs);
+  }
+  if (config.network.fleetRole == FleetRole::Leader && millis() - fleet.lastSendMs >= FLEET_BEACON_INTERVAL_MS) {
+    sendFleetBeacon();
+  }
+}
+
+bool isFleetLocked() {
+  return config.network.fleetRole == FleetRole::Follower && fleet.leaderId != 0 &&
+         millis() - fleet.lastBeaconMs < FLEET_LOCK_TIMEOUT_MS;
 }
 
 void ensureWiFi() {
@@ -1299,6 +5788,7 @@ void ensureWiFi() {
   wifiManager.setTimeout(180);
   bool connected = wifiManager.autoConnect("Clock-Setup");
   if (!connected) {
+    flushConfig();
     delay(1000);
     ESP.restart();
   }
@@ -1307,11 +5797,16 @@ void ensureWiFi() {
 void setupOta() {
   ArduinoOTA.setHostname("esp8266-clock");
   ArduinoOTA.onStart([]() {
+    if (configStore.dirty) {
+      flushConfig();  // the file system may be replaced and the device reboots afterwards
+    }
+    saveRtcCheckpoint();
 #ifdef DEBUG_SERIAL
     Serial.println(F("[OTA] Start update"));
 #endif
   });
   ArduinoOTA.onEnd([]() {
+    saveRtcCheckpoint();  // the reboot follows right away
 #ifdef DEBUG_SERIAL
     Serial.println(F("[OTA] Update finished"));
 #endif
@@ -1344,25 +5839,29 @@ void setup() {
   Serial.println(F("[Clock] Booting"));
 #endif  // DEBUG_SERIAL
 
-  strip.begin();
-  strip.clear();
-  strip.show();
-
   if (!loadConfig()) {
 #ifdef DEBUG_SERIAL
     Serial.println(F("[Clock] Using default configuration"));
 #endif  // DEBUG_SERIAL
   }
-  timeAnchor = config.time;
-  timeReferenceMs = millis();
+  applyTimeZoneConfig();
+  compileBrightnessSchedule();
+  loadLayout();
+  openAnimation();
+  ledOutput.begin(activeLayout.ledCount);
+  invalidateShadowFrame();
+  if (!restoreRtcCheckpoint()) {
+    setTimeBaseFromLocal(config.time);
+  }
+  saveRtcCheckpoint();
   applyDisplaySettings();
+  updateDisplay();  // shows the restored time while WiFi connects
 
   ensureWiFi();
   setupOta();
   setupSinric();
-  if (syncTimeFromNtp()) {
-    saveConfig();
-  }
+  startNtpSync();
+  applyFleetConfig();
   applyDisplaySettings();
   setupWebServer();
 #ifdef DEBUG_SERIAL
@@ -1372,20 +5871,45 @@ void setup() {
 }
 
 void loop() {
+  ledOutput.service();
   ArduinoOTA.handle();
-  processSinric();
   unsigned long nowMs = millis();
   if (WiFi.status() == WL_CONNECTED) {
     bool needInitialSync = (lastNtpSyncMs == 0);
     bool dueDailySync = (!needInitialSync) && (nowMs - lastNtpSyncMs >= NTP_SYNC_INTERVAL_MS);
     bool readyForRetry = (nowMs - lastNtpAttemptMs >= NTP_RETRY_INTERVAL_MS);
-    if ((needInitialSync || dueDailySync) && readyForRetry) {
-      syncTimeFromNtp();
+    if ((needInitialSync || dueDailySync) && readyForRetry && ntpClient.state == NtpState::Idle) {
+      startNtpSync();
     }
   }
+  serviceNtp();
+  serviceFleetSync();
+  if (nowMs - lastRtcCheckpointMs >= RTC_CHECKPOINT_INTERVAL_MS) {
+    saveRtcCheckpoint();
+  }
+  serviceConfigSave();
   server.handleClient();
-  if (nowMs - lastDisplayRefresh >= DISPLAY_REFRESH_MS) {
-    lastDisplayRefresh = nowMs;
-    updateDisplay();
+  const unsigned long serviceUs = micros();
+  if (lastClientServiceUs != 0) {
+    const uint32_t gapUs = serviceUs - lastClientServiceUs;
+    animationStats.maxLoopGapUs = max(animationStats.maxLoopGapUs, gapUs);
+    if (gapUs > HTTP_LATENCY_TARGET_US) {
+      ++animationStats.loopGapsOverTarget;
+    }
+  }
+  lastClientServiceUs = serviceUs;
+  processSinric();
+  applyCommands();  // the only place where queued changes take effect
+
+  if (static_cast<long>(millis() - displaySchedule.nextRefreshMs) >= 0) {
+    if (displaySchedule.animated) {
+      ++animationStats.frames;
+      if (displaySchedule.throttled) {
+        ++animationStats.throttled;
+      }
+    } else {
+      ++schedulerStats.eventWakeups;
+    }
+    updateDisplay();  // schedules the next refresh
   }
 }
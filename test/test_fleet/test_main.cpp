@@ -0,0 +1,170 @@
+// Runs a simulated follower of LAN phase sync: beacons from a leader reach it with random
+// network delays, go through FleetWindow and move its time base with planPhaseAlignment(), as
+// handleFleetBeacon() does. Run with: pio test -e native -f test_fleet
+#include <unity.h>
+
+#include "fleet_phase.h"
+
+namespace {
+
+// As in main.cpp.
+constexpr uint8_t FLEET_WINDOW_BEACONS = 8;
+constexpr uint32_t FLEET_BEACON_INTERVAL_MS = 500;
+constexpr int32_t TIME_STEP_THRESHOLD_MS = 1000;
+constexpr uint32_t TIME_SLEW_RATE_PPM = 5000;
+
+constexpr uint64_t LEADER_START_EPOCH_MS = 1700000000000ULL;
+
+// The time base of main.cpp without the drift term: anchor, elapsed time and applied slew.
+struct FollowerTimeBase {
+  uint64_t anchorEpochMs{0};
+  uint64_t anchorLocalMs{0};
+  int32_t slewMs{0};
+
+  uint64_t epochAt(uint64_t localMs) const {
+    const uint64_t elapsed = localMs - anchorLocalMs;
+    return anchorEpochMs + elapsed + slewProgressMs(slewMs, elapsed, TIME_SLEW_RATE_PPM);
+  }
+  bool align(uint64_t localMs, int64_t errorMs) {
+    const PhaseAlignment alignment = planPhaseAlignment(epochAt(localMs), errorMs, TIME_STEP_THRESHOLD_MS);
+    anchorEpochMs = alignment.anchorEpochMs;
+    anchorLocalMs = localMs;
+    slewMs = alignment.slewMs;
+    return alignment.step;
+  }
+};
+
+// Beacon delays of a busy WiFi LAN: 1-4 ms, plus up to 120 ms of queueing for every other one.
+struct DelayModel {
+  uint32_t state{12345};
+  uint32_t next() {
+    state = state * 1103515245UL + 12345UL;
+    return state >> 8;
+  }
+  uint32_t delayMs() {
+    const uint32_t base = 1 + next() % 4;
+    return next() % 2 == 0 ? base : base + next() % 120;
+  }
+};
+
+struct FollowerRun {
+  int64_t finalErrorMs;  // leader minus follower at the end of the run
+  uint32_t alignments;
+  uint32_t steps;
+  int64_t maxLateErrorMs;  // largest error over the last quarter of the run
+};
+
+// The leader and the follower share the local millisecond axis; the follower starts
+// initialErrorMs behind the leader.
+FollowerRun runFollower(int64_t initialErrorMs, uint32_t beacons) {
+  FollowerTimeBase follower;
+  follower.anchorEpochMs = static_cast<uint64_t>(static_cast<int64_t>(LEADER_START_EPOCH_MS) - initialErrorMs);
+  FleetWindow window;
+  DelayModel delays;
+  FollowerRun run{0, 0, 0, 0};
+  for (uint32_t i = 0; i < beacons; ++i) {
+    const uint64_t sentLocalMs = static_cast<uint64_t>(i) * FLEET_BEACON_INTERVAL_MS;
+    const uint64_t receivedLocalMs = sentLocalMs + delays.delayMs();
+    const int64_t offsetMs = static_cast<int64_t>(LEADER_START_EPOCH_MS + sentLocalMs - follower.epochAt(receivedLocalMs));
+    int64_t correctionMs;
+    if (window.add(offsetMs, FLEET_WINDOW_BEACONS, correctionMs)) {
+      ++run.alignments;
+      run.steps += follower.align(receivedLocalMs, correctionMs) ? 1 : 0;
+    }
+    const int64_t errorMs = static_cast<int64_t>(LEADER_START_EPOCH_MS + receivedLocalMs - follower.epochAt(receivedLocalMs));
+    if (i >= beacons * 3 / 4) {
+      const int64_t magnitude = errorMs < 0 ? -errorMs : errorMs;
+      run.maxLateErrorMs = magnitude > run.maxLateErrorMs ? magnitude : run.maxLateErrorMs;
+    }
+    run.finalErrorMs = errorMs;
+  }
+  return run;
+}
+
+void test_window_keeps_largest_offset() {
+  FleetWindow window;
+  const int64_t offsets[] = {-40, -12, -95, -7, -60, -33, -8, -21};
+  int64_t correctionMs = 0;
+  for (uint8_t i = 0; i + 1 < FLEET_WINDOW_BEACONS; ++i) {
+    TEST_ASSERT_FALSE(window.add(offsets[i], FLEET_WINDOW_BEACONS, correctionMs));
+  }
+  TEST_ASSERT_TRUE(window.add(offsets[FLEET_WINDOW_BEACONS - 1], FLEET_WINDOW_BEACONS, correctionMs));
+  TEST_ASSERT_EQUAL_INT64(-7, correctionMs);
+
+  // The next window starts from scratch: its best offset may be lower than the previous one.
+  for (uint8_t i = 0; i + 1 < FLEET_WINDOW_BEACONS; ++i) {
+    TEST_ASSERT_FALSE(window.add(-300 - i, FLEET_WINDOW_BEACONS, correctionMs));
+  }
+  TEST_ASSERT_TRUE(window.add(-250, FLEET_WINDOW_BEACONS, correctionMs));
+  TEST_ASSERT_EQUAL_INT64(-250, correctionMs);
+
+  // A reset (new leader) drops the beacons seen so far.
+  window.add(500, FLEET_WINDOW_BEACONS, correctionMs);
+  window.reset();
+  for (uint8_t i = 0; i + 1 < FLEET_WINDOW_BEACONS; ++i) {
+    TEST_ASSERT_FALSE(window.add(10, FLEET_WINDOW_BEACONS, correctionMs));
+  }
+  TEST_ASSERT_TRUE(window.add(10, FLEET_WINDOW_BEACONS, correctionMs));
+  TEST_ASSERT_EQUAL_INT64(10, correctionMs);
+}
+
+void test_alignment_slews_or_steps() {
+  const uint64_t epochMs = LEADER_START_EPOCH_MS;
+  PhaseAlignment alignment = planPhaseAlignment(epochMs, 300, TIME_STEP_THRESHOLD_MS);
+  TEST_ASSERT_FALSE(alignment.step);
+  TEST_ASSERT_EQUAL_UINT64(epochMs, alignment.anchorEpochMs);
+  TEST_ASSERT_EQUAL_INT(300, alignment.slewMs);
+
+  alignment = planPhaseAlignment(epochMs, -999, TIME_STEP_THRESHOLD_MS);
+  TEST_ASSERT_FALSE(alignment.step);
+  TEST_ASSERT_EQUAL_INT(-999, alignment.slewMs);
+
+  alignment = planPhaseAlignment(epochMs, 1000, TIME_STEP_THRESHOLD_MS);
+  TEST_ASSERT_TRUE(alignment.step);
+  TEST_ASSERT_EQUAL_UINT64(epochMs + 1000, alignment.anchorEpochMs);
+  TEST_ASSERT_EQUAL_INT(0, alignment.slewMs);
+
+  alignment = planPhaseAlignment(epochMs, -5000, TIME_STEP_THRESHOLD_MS);
+  TEST_ASSERT_TRUE(alignment.step);
+  TEST_ASSERT_EQUAL_UINT64(epochMs - 5000, alignment.anchorEpochMs);
+}
+
+void test_slew_progress() {
+  TEST_ASSERT_EQUAL_INT(50, slewProgressMs(300, 10000, TIME_SLEW_RATE_PPM));    // 5 ms per second
+  TEST_ASSERT_EQUAL_INT(300, slewProgressMs(300, 100000, TIME_SLEW_RATE_PPM));  // then done
+  TEST_ASSERT_EQUAL_INT(-100, slewProgressMs(-300, 20000, TIME_SLEW_RATE_PPM));
+  TEST_ASSERT_EQUAL_INT(0, slewProgressMs(0, 20000, TIME_SLEW_RATE_PPM));
+}
+
+void test_follower_slews_into_phase() {
+  // Slewed at 5 ms/s: 84 s for 420 ms, 130 s for 650 ms, out of the 4 minutes simulated.
+  const FollowerRun behind = runFollower(420, 480);
+  TEST_ASSERT_EQUAL(0, behind.steps);
+  TEST_ASSERT_EQUAL(480 / FLEET_WINDOW_BEACONS, behind.alignments);
+  TEST_ASSERT_TRUE(behind.maxLateErrorMs <= 4);
+
+  const FollowerRun ahead = runFollower(-650, 480);
+  TEST_ASSERT_EQUAL(0, ahead.steps);
+  TEST_ASSERT_TRUE(ahead.maxLateErrorMs <= 4);
+}
+
+void test_follower_steps_large_errors() {
+  const FollowerRun run = runFollower(30000, 240);
+  TEST_ASSERT_EQUAL(1, run.steps);  // the first window only, the rest is slewed
+  TEST_ASSERT_TRUE(run.maxLateErrorMs <= 4);
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_window_keeps_largest_offset);
+  RUN_TEST(test_alignment_slews_or_steps);
+  RUN_TEST(test_slew_progress);
+  RUN_TEST(test_follower_slews_into_phase);
+  RUN_TEST(test_follower_steps_large_errors);
+  return UNITY_END();
+}
@@ -0,0 +1,262 @@
+// Drives NtpExchange against a local UDP NTP stand-in on loopback, the way serviceNtp() does
+// from loop(), and checks that no poll ever blocks. Run with: pio test -e native -f test_ntp
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <unity.h>
+
+#include "ntp_exchange.h"
+
+namespace {
+
+constexpr uint32_t TEST_TIMEOUT_MS = 100;  // shorter than NTP_REPLY_TIMEOUT_MS to keep the run fast
+constexpr uint8_t TEST_MAX_ATTEMPTS = 2;
+constexpr uint32_t MAX_POLL_US = 2000;     // "a few milliseconds" at most, loopback takes microseconds
+constexpr int64_t SERVER_OFFSET_MS = 1500;
+
+uint32_t millisNow() {
+  using namespace std::chrono;
+  return static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t microsNow() {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+int64_t epochMillisNow() {
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+// The fraction is rounded up so that ntpTimestampToEpochMs(), which truncates, reads epochMs back.
+void writeNtpTimestamp(uint8_t *bytes, int64_t epochMs) {
+  writeBe32(bytes, static_cast<uint32_t>(epochMs / 1000 + NTP_UNIX_EPOCH_OFFSET));
+  writeBe32(bytes + 4, static_cast<uint32_t>(((static_cast<uint64_t>(epochMs % 1000) << 32) + 999) / 1000));
+}
+
+int openLoopbackSocket(sockaddr_in &address) {
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  address = sockaddr_in{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+  socklen_t length = sizeof(address);
+  getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length);
+  return fd;
+}
+
+// Answers client requests like an SNTP server whose clock runs offsetMs ahead of the host.
+struct NtpResponder {
+  int fd{-1};
+  sockaddr_in address{};
+  int64_t offsetMs{SERVER_OFFSET_MS};
+  int dropRequests{0};  // requests left unanswered before replying, -1 for a silent server
+  uint8_t stratum{2};
+  bool echoCookie{true};
+  int requests{0};
+
+  NtpResponder() { fd = openLoopbackSocket(address); }
+  ~NtpResponder() { close(fd); }
+
+  void service() {
+    uint8_t packet[NTP_PACKET_BYTES];
+    sockaddr_in client{};
+    socklen_t clientLength = sizeof(client);
+    while (recvfrom(fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&client), &clientLength) ==
+           static_cast<ssize_t>(sizeof(packet))) {
+      ++requests;
+      if (dropRequests != 0) {
+        if (dropRequests > 0) {
+          --dropRequests;
+        }
+        continue;
+      }
+      uint8_t reply[NTP_PACKET_BYTES] = {0};
+      reply[0] = 0b00100100;  // no leap warning, version 4, mode 4 (server)
+      reply[1] = stratum;
+      if (echoCookie) {
+        memcpy(reply + 24, packet + 40, 8);
+      }
+      writeNtpTimestamp(reply + 32, epochMillisNow() + offsetMs);
+      writeNtpTimestamp(reply + 40, epochMillisNow() + offsetMs);
+      sendto(fd, reply, sizeof(reply), 0, reinterpret_cast<sockaddr *>(&client), clientLength);
+    }
+  }
+};
+
+// The Udp interface of NtpExchange over a non-blocking POSIX socket.
+struct LoopbackUdp {
+  int fd{-1};
+  sockaddr_in address{};
+  sockaddr_in server{};
+
+  explicit LoopbackUdp(const sockaddr_in &serverAddress) : server(serverAddress) { fd = openLoopbackSocket(address); }
+  ~LoopbackUdp() { close(fd); }
+
+  bool send(const uint8_t *packet, size_t size) {
+    uint8_t stale[NTP_PACKET_BYTES];
+    while (recv(fd, stale, sizeof(stale), 0) >= 0) {
+    }
+    return sendto(fd, packet, size, 0, reinterpret_cast<const sockaddr *>(&server), sizeof(server)) ==
+           static_cast<ssize_t>(size);
+  }
+  int receive(uint8_t *packet, size_t size) {
+    sockaddr_in from{};
+    socklen_t fromLength = sizeof(from);
+    const ssize_t length = recvfrom(fd, packet, size, 0, reinterpret_cast<sockaddr *>(&from), &fromLength);
+    if (length < 0) {
+      return 0;
+    }
+    if (from.sin_addr.s_addr != server.sin_addr.s_addr || from.sin_port != server.sin_port) {
+      return -1;
+    }
+    return static_cast<int>(length);
+  }
+};
+
+struct ExchangeResult {
+  NtpPoll outcome{NtpPoll::Pending};
+  uint8_t attempts{0};
+  uint32_t timeouts{0};
+  uint32_t polls{0};
+  uint64_t maxPollUs{0};
+  uint32_t elapsedMs{0};
+  NtpMeasurement measurement{0, 0};
+};
+
+// Mirrors the Waiting state of serviceNtp(): one poll per loop() pass, another request after a
+// timeout, until a reply or a failure. The responder is serviced in between, as if remote.
+ExchangeResult runExchange(NtpResponder &responder, uint32_t generation) {
+  LoopbackUdp udp(responder.address);
+  NtpExchange exchange;
+  ExchangeResult result;
+  const uint32_t startMs = millisNow();
+  int64_t sentEpochMs = epochMillisNow();
+  exchange.send(udp, millisNow(), generation);
+  while (millisNow() - startMs < 10 * TEST_TIMEOUT_MS) {
+    responder.service();
+    uint8_t packet[NTP_PACKET_BYTES];
+    const uint64_t pollStartUs = microsNow();
+    const NtpPoll outcome = exchange.poll(udp, millisNow(), TEST_TIMEOUT_MS, TEST_MAX_ATTEMPTS, packet);
+    const int64_t receivedEpochMs = epochMillisNow();
+    result.maxPollUs = std::max(result.maxPollUs, microsNow() - pollStartUs);
+    ++result.polls;
+    if (outcome == NtpPoll::Timeout) {
+      ++result.timeouts;
+      sentEpochMs = epochMillisNow();
+      exchange.send(udp, millisNow(), generation);
+      continue;
+    }
+    if (outcome != NtpPoll::Pending) {
+      result.outcome = outcome;
+      if (outcome == NtpPoll::Failed) {
+        ++result.timeouts;
+      } else if (outcome == NtpPoll::Reply) {
+        result.measurement = measureNtpReply(packet, sentEpochMs, receivedEpochMs);
+      }
+      break;
+    }
+    usleep(200);  // the rest of loop()
+  }
+  result.attempts = exchange.attempt;
+  result.elapsedMs = millisNow() - startMs;
+  return result;
+}
+
+void test_offset_computation() {
+  uint8_t packet[NTP_PACKET_BYTES] = {0};
+  const int64_t t1 = 1700000000000LL;
+  writeNtpTimestamp(packet + 32, t1 + 600);  // t2: 10 ms path each way, 590 ms ahead
+  writeNtpTimestamp(packet + 40, t1 + 610);  // t3: 10 ms in the server
+  const NtpMeasurement measurement = measureNtpReply(packet, t1, t1 + 30);
+  TEST_ASSERT_EQUAL_INT64(590, measurement.offsetMs);
+  TEST_ASSERT_EQUAL_INT64(20, measurement.rttMs);
+
+  // A server behind the host, with an asymmetric path: the offset error is half the asymmetry.
+  writeNtpTimestamp(packet + 32, t1 - 2000 + 40);
+  writeNtpTimestamp(packet + 40, t1 - 2000 + 41);
+  const NtpMeasurement behind = measureNtpReply(packet, t1, t1 + 51);
+  TEST_ASSERT_EQUAL_INT64(50, behind.rttMs);
+  TEST_ASSERT_EQUAL_INT64(-2000 + 15, behind.offsetMs);
+
+  // Fractions are kept to the millisecond.
+  writeNtpTimestamp(packet + 32, t1 + 999);
+  TEST_ASSERT_EQUAL_INT64(t1 + 999, ntpTimestampToEpochMs(packet + 32));
+}
+
+void test_reply() {
+  NtpResponder responder;
+  const ExchangeResult result = runExchange(responder, 7);
+  TEST_ASSERT_TRUE(result.outcome == NtpPoll::Reply);
+  TEST_ASSERT_EQUAL(1, result.attempts);
+  TEST_ASSERT_EQUAL(0, result.timeouts);
+  TEST_ASSERT_INT64_WITHIN(5, SERVER_OFFSET_MS, result.measurement.offsetMs);
+  TEST_ASSERT_TRUE(result.measurement.rttMs >= 0 && result.measurement.rttMs <= 5);
+  TEST_ASSERT_TRUE(result.maxPollUs <= MAX_POLL_US);
+}
+
+void test_timeout_then_retry() {
+  NtpResponder responder;
+  responder.dropRequests = 1;
+  responder.offsetMs = -250;
+  const ExchangeResult result = runExchange(responder, 8);
+  TEST_ASSERT_TRUE(result.outcome == NtpPoll::Reply);
+  TEST_ASSERT_EQUAL(2, responder.requests);
+  TEST_ASSERT_EQUAL(2, result.attempts);
+  TEST_ASSERT_EQUAL(1, result.timeouts);
+  TEST_ASSERT_TRUE(result.elapsedMs >= TEST_TIMEOUT_MS);
+  // t1 is the time of the retry, not of the first request.
+  TEST_ASSERT_INT64_WITHIN(5, -250, result.measurement.offsetMs);
+  TEST_ASSERT_TRUE(result.measurement.rttMs >= 0 && result.measurement.rttMs <= 5);
+  TEST_ASSERT_TRUE(result.polls > 10);  // the wait was spread over many passes of loop()
+  TEST_ASSERT_TRUE(result.maxPollUs <= MAX_POLL_US);
+}
+
+void test_failure_after_max_attempts() {
+  NtpResponder responder;
+  responder.dropRequests = -1;
+  const ExchangeResult result = runExchange(responder, 9);
+  TEST_ASSERT_TRUE(result.outcome == NtpPoll::Failed);
+  TEST_ASSERT_EQUAL(TEST_MAX_ATTEMPTS, responder.requests);
+  TEST_ASSERT_EQUAL(TEST_MAX_ATTEMPTS, result.timeouts);
+  TEST_ASSERT_TRUE(result.elapsedMs >= TEST_MAX_ATTEMPTS * TEST_TIMEOUT_MS);
+  TEST_ASSERT_TRUE(result.maxPollUs <= MAX_POLL_US);
+}
+
+void test_rejected_replies() {
+  // A reply that does not echo our cookie is ignored: the exchange times out instead.
+  NtpResponder stray;
+  stray.echoCookie = false;
+  const ExchangeResult ignored = runExchange(stray, 10);
+  TEST_ASSERT_TRUE(ignored.outcome == NtpPoll::Failed);
+
+  // A kiss-of-death (stratum 0) ends the exchange at once.
+  NtpResponder kissOfDeath;
+  kissOfDeath.stratum = 0;
+  const ExchangeResult rejected = runExchange(kissOfDeath, 11);
+  TEST_ASSERT_TRUE(rejected.outcome == NtpPoll::Unusable);
+  TEST_ASSERT_EQUAL(1, rejected.attempts);
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_offset_computation);
+  RUN_TEST(test_reply);
+  RUN_TEST(test_timeout_then_retry);
+  RUN_TEST(test_failure_after_max_attempts);
+  RUN_TEST(test_rejected_replies);
+  return UNITY_END();
+}
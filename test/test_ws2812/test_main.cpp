@@ -0,0 +1,174 @@
+// Decodes the I2S samples built for the DMA LED backend back into WS2812 bits and checks them
+// against the WS2812B timings. Run with: pio test -e native -f test_ws2812
+#include <algorithm>
+
+#include <unity.h>
+
+#include "ws2812_i2s.h"
+
+namespace {
+
+constexpr double I2S_BIT_NS = 1e9 / (WS2812_I2S_SAMPLE_RATE * 32.0);  // 312.5 ns
+
+// WS2812B datasheet: T0H 0.4 us, T1H 0.8 us, TH + TL 1.25 us, each within 150 ns; newer parts
+// latch after 280 us low.
+constexpr double T0H_NS = 400;
+constexpr double T1H_NS = 800;
+constexpr double BIT_NS = 1250;
+constexpr double TOLERANCE_NS = 150;
+constexpr double RESET_MIN_NS = 280000;
+
+constexpr size_t MAX_TEST_BYTES = 450;  // 150 LEDs, longer than the DMA ring
+uint32_t samples[i2sFrameSamples(MAX_TEST_BYTES)];
+
+bool levelAt(const uint32_t *frame, size_t bit) {
+  return (frame[bit / 32] >> (31 - bit % 32)) & 1;
+}
+
+struct DecodedFrame {
+  uint8_t bytes[MAX_TEST_BYTES];
+  size_t length;
+  double maxHighErrorNs;    // worst distance of a high pulse from T0H or T1H
+  double maxPeriodErrorNs;  // worst distance of a bit period from 1.25 us
+  double resetNs;           // low time after the last bit
+};
+
+// Walks the line level like a WS2812 would: each rising edge starts a bit, whose value is
+// given by the width of the high pulse. The low run following the last bit is the reset gap.
+bool decodeFrame(const uint32_t *frame, size_t total, DecodedFrame &decoded) {
+  decoded = DecodedFrame{};
+  const size_t bits = total * 32;
+  size_t bit = 0;
+  size_t decodedBits = 0;
+  while (bit < bits && levelAt(frame, bit)) {
+    size_t high = 0;
+    while (bit < bits && levelAt(frame, bit)) {
+      ++high;
+      ++bit;
+    }
+    size_t low = 0;
+    while (bit < bits && !levelAt(frame, bit)) {
+      ++low;
+      ++bit;
+    }
+    const double highNs = high * I2S_BIT_NS;
+    const bool one = highNs > (T0H_NS + T1H_NS) / 2;
+    const double highError = highNs - (one ? T1H_NS : T0H_NS);
+    decoded.maxHighErrorNs = std::max(decoded.maxHighErrorNs, highError < 0 ? -highError : highError);
+    const bool last = bit == bits || low * I2S_BIT_NS > BIT_NS * 8;
+    if (last) {
+      // The nominal low time of the bit comes first, the rest of the run is the reset gap.
+      const size_t bitLow = 4 - high;
+      decoded.resetNs = (low - bitLow) * I2S_BIT_NS;
+      low = bitLow;
+    }
+    const double periodError = (high + low) * I2S_BIT_NS - BIT_NS;
+    decoded.maxPeriodErrorNs = std::max(decoded.maxPeriodErrorNs, periodError < 0 ? -periodError : periodError);
+    if (decodedBits / 8 >= MAX_TEST_BYTES) {
+      return false;
+    }
+    decoded.bytes[decodedBits / 8] = static_cast<uint8_t>((decoded.bytes[decodedBits / 8] << 1) | (one ? 1 : 0));
+    ++decodedBits;
+    if (last) {
+      break;
+    }
+  }
+  decoded.length = decodedBits / 8;
+  return decodedBits % 8 == 0 && bit == bits;
+}
+
+void fillGarbage() {
+  for (uint32_t &sample : samples) {
+    sample = 0xFFFFFFFFUL;  // the padding must not depend on the previous frame
+  }
+}
+
+void checkFrame(const uint8_t *grb, size_t length) {
+  fillGarbage();
+  const size_t total = encodeWs2812Frame(grb, length, samples);
+  TEST_ASSERT_EQUAL(i2sFrameSamples(length), total);
+  TEST_ASSERT_EQUAL(0, total % I2S_DMA_BUFFER_SAMPLES);
+
+  DecodedFrame decoded;
+  TEST_ASSERT_TRUE(decodeFrame(samples, total, decoded));
+  TEST_ASSERT_EQUAL(length, decoded.length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(grb, decoded.bytes, length);
+  TEST_ASSERT_TRUE(decoded.maxHighErrorNs <= TOLERANCE_NS);
+  TEST_ASSERT_TRUE(decoded.maxPeriodErrorNs <= TOLERANCE_NS);
+  TEST_ASSERT_TRUE(decoded.resetNs >= RESET_MIN_NS);
+  for (size_t i = length; i < total; ++i) {
+    TEST_ASSERT_EQUAL_HEX32(0, samples[i]);
+  }
+}
+
+void test_byte_encoding() {
+  TEST_ASSERT_EQUAL_HEX32(0x88888888UL, encodeWs2812Byte(0x00));
+  TEST_ASSERT_EQUAL_HEX32(0xEEEEEEEEUL, encodeWs2812Byte(0xFF));
+  TEST_ASSERT_EQUAL_HEX32(0xE8E88E8EUL, encodeWs2812Byte(0xA5));
+}
+
+void test_known_frame() {
+  // Two LEDs, GRB: a dim orange and pure blue.
+  const uint8_t grb[] = {0x20, 0xFF, 0x00, 0x00, 0x00, 0xA5};
+  checkFrame(grb, sizeof(grb));
+  TEST_ASSERT_EQUAL_HEX32(0x88E88888UL, samples[0]);
+  TEST_ASSERT_EQUAL_HEX32(0xE8E88E8EUL, samples[5]);
+}
+
+void test_bit_timings() {
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 312.5, I2S_BIT_NS);
+  // 1000 and 1110 give 312.5 ns and 937.5 ns high pulses in a 1.25 us bit.
+  const uint8_t grb[] = {0x00, 0xFF, 0x55, 0xAA};
+  fillGarbage();
+  const size_t total = encodeWs2812Frame(grb, sizeof(grb), samples);
+  DecodedFrame decoded;
+  TEST_ASSERT_TRUE(decodeFrame(samples, total, decoded));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 137.5, decoded.maxHighErrorNs);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.0, decoded.maxPeriodErrorNs);
+}
+
+void test_reset_gap() {
+  uint8_t grb[MAX_TEST_BYTES];
+  for (size_t i = 0; i < sizeof(grb); ++i) {
+    grb[i] = static_cast<uint8_t>(i * 37);
+  }
+  // 32 bytes leave exactly WS2812_RESET_SAMPLES in the first buffer, 33 spill into a second one.
+  const size_t lengths[] = {1, 3, 30, 32, 33, 96, 390, I2S_DMA_QUEUE_SAMPLES, MAX_TEST_BYTES};
+  for (size_t length : lengths) {
+    checkFrame(grb, length);
+  }
+  TEST_ASSERT_EQUAL(64, i2sFrameSamples(32));
+  TEST_ASSERT_EQUAL(128, i2sFrameSamples(33));
+  TEST_ASSERT_FLOAT_WITHIN(1, 320000.0, WS2812_RESET_SAMPLES * 32 * I2S_BIT_NS);
+}
+
+void test_black_frame() {
+  // begin() blanks the strip by padding pre-encoded zero bytes.
+  fillGarbage();
+  for (size_t i = 0; i < 90; ++i) {
+    samples[i] = encodeWs2812Byte(0);
+  }
+  const size_t total = padWs2812Frame(samples, 90);
+  DecodedFrame decoded;
+  TEST_ASSERT_TRUE(decodeFrame(samples, total, decoded));
+  TEST_ASSERT_EQUAL(90, decoded.length);
+  for (size_t i = 0; i < decoded.length; ++i) {
+    TEST_ASSERT_EQUAL_UINT8(0, decoded.bytes[i]);
+  }
+  TEST_ASSERT_TRUE(decoded.resetNs >= RESET_MIN_NS);
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_byte_encoding);
+  RUN_TEST(test_known_frame);
+  RUN_TEST(test_bit_timings);
+  RUN_TEST(test_reset_gap);
+  RUN_TEST(test_black_frame);
+  return UNITY_END();
+}